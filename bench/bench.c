@@ -0,0 +1,300 @@
+// cmdapp: bench.c: Micro-benchmarks for the cmdapp library.
+// Copyright (C) 2021 Ethan Uppal
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "cmdapp.h"
+#include "cmdapp_getopt.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+// Each case runs for at least this long, and at least once.
+#define BENCH_MIN_NS 200000000.0
+
+// Allocation counting relies on the linker wrapping malloc and friends, see
+// the bench target in the Makefile.
+#ifdef BENCH_COUNT_ALLOCS
+static size_t allocations;
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t count, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+void* __wrap_malloc(size_t size) {
+    allocations++;
+    return __real_malloc(size);
+}
+void* __wrap_calloc(size_t count, size_t size) {
+    allocations++;
+    return __real_calloc(count, size);
+}
+void* __wrap_realloc(void* ptr, size_t size) {
+    allocations++;
+    return __real_realloc(ptr, size);
+}
+#define ALLOCATIONS() ((double)allocations)
+#else
+#define ALLOCATIONS() (0.0 / 0.0)
+#endif /* BENCH_COUNT_ALLOCS */
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+typedef enum {
+    FORM_SHORT,   // -a -b -c
+    FORM_LONG,    // --option-0 --option-1
+    FORM_BUNDLED, // -abc -def
+    FORM_VALUE,   // --value-0=x --value-1=x
+    FORM_COUNT
+} form_t;
+
+static const char* form_names[FORM_COUNT] = {
+    "short", "long", "bundled", "--opt=value"
+};
+
+// Short names for the first options of a spec.
+static const char shorts[] =
+    "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ";
+#define SHORT_COUNT (sizeof(shorts) - 1)
+
+// A synthetic spec of `count` options: the first half are flags named
+// option-N, the second half take arguments and are named value-N. Pairs of
+// options in the unused upper quarter conflict, so that validation has
+// conflict rows to check.
+typedef struct {
+    size_t count;
+    // Room for "option-" and the digits of any size_t
+    char (*names)[32];
+    cmdopt_t* options;
+    cmdopt_t* (*conflicts)[2];
+    struct option* longopts;
+    char optstring[SHORT_COUNT + 1];
+} spec_t;
+
+static void spec_init(spec_t* spec, size_t count) {
+    spec->count = count;
+    spec->names = malloc(count * sizeof(*spec->names));
+    spec->options = malloc(count * sizeof(cmdopt_t));
+    spec->conflicts = malloc(count * sizeof(*spec->conflicts));
+    spec->longopts = calloc(count + 1, sizeof(struct option));
+    size_t shorto = 0;
+    for (size_t i = 0; i < count; i++) {
+        const bool value = i >= count / 2;
+        snprintf(spec->names[i], sizeof(*spec->names), "%s-%zu",
+                 value ? "value" : "option", i);
+        spec->conflicts[i][0] = (i >= count * 3 / 4)
+                                ? &spec->options[i ^ 1] : NULL;
+        spec->conflicts[i][1] = NULL;
+        spec->longopts[i].name = spec->names[i];
+        spec->longopts[i].has_arg = value ? required_argument : no_argument;
+        spec->longopts[i].val = 256 + (int)i;
+        if (!value && shorto < SHORT_COUNT) {
+            spec->optstring[shorto] = shorts[shorto];
+            shorto++;
+        }
+    }
+    spec->optstring[shorto] = 0;
+}
+
+static void spec_register(const spec_t* spec, cmdapp_t* app) {
+    size_t shorto = 0;
+    for (size_t i = 0; i < spec->count; i++) {
+        const bool value = i >= spec->count / 2;
+        char c = 0;
+        if (!value && shorto < SHORT_COUNT) {
+            c = shorts[shorto++];
+        }
+        cmdapp_set(app, c, spec->names[i],
+                   CMDOPT_OPTIONAL | (value ? CMDOPT_TAKESARG : 0),
+                   spec->conflicts[i], "", &spec->options[i]);
+    }
+}
+
+static void spec_destroy(spec_t* spec) {
+    free(spec->names);
+    free(spec->options);
+    free(spec->conflicts);
+    free(spec->longopts);
+}
+
+// Builds an argv of `argc` entries (including argv[0]) in the given form.
+static char** make_argv(const spec_t* spec, form_t form, size_t argc,
+                        char** storage) {
+    char** argv = malloc((argc + 1) * sizeof(char*));
+    char* text = malloc(argc * 32);
+    *storage = text;
+    argv[0] = "bench";
+    const size_t flags = strlen(spec->optstring);
+    const size_t half = spec->count / 2;
+    for (size_t i = 1; i < argc; i++) {
+        argv[i] = text;
+        switch (form) {
+            case FORM_SHORT:
+                text += sprintf(text, "-%c", spec->optstring[i % flags]);
+                break;
+            case FORM_LONG:
+                text += sprintf(text, "--%s", spec->names[i % half]);
+                break;
+            case FORM_BUNDLED:
+                text += sprintf(text, "-%c%c%c", spec->optstring[i % flags],
+                                spec->optstring[(i + 1) % flags],
+                                spec->optstring[(i + 2) % flags]);
+                break;
+            case FORM_VALUE:
+                // Only the lower half of the value options, which have no
+                // conflicts.
+                text += sprintf(text, "--%s=x",
+                                spec->names[half + i % (spec->count / 4)]);
+                break;
+            default:
+                break;
+        }
+        text++;
+    }
+    argv[argc] = NULL;
+    return argv;
+}
+
+typedef struct {
+    double ns;
+    double allocations;
+} measure_t;
+
+static measure_t bench_cmdapp(const spec_t* spec, int argc, char** argv) {
+    cmdapp_t app;
+    const cmdapp_info_t info = { .program = "bench", .description = "" };
+    cmdapp_init(&app, argc, argv, CMDAPP_MODE_MULTIFLAG, &info);
+    spec_register(spec, &app);
+    // The first run builds the index, which is measured separately.
+    if (cmdapp_run_argv(&app, argc, argv) != EXIT_SUCCESS) {
+        fprintf(stderr, "bench: cmdapp rejected the input\n");
+        exit(1);
+    }
+    size_t iterations = 0;
+    const double before = ALLOCATIONS();
+    const double start = now_ns();
+    double elapsed;
+    do {
+        cmdapp_run_argv(&app, argc, argv);
+        iterations++;
+    } while ((elapsed = now_ns() - start) < BENCH_MIN_NS);
+    const measure_t measure = {
+        elapsed / iterations, (ALLOCATIONS() - before) / iterations
+    };
+    cmdapp_destroy(&app);
+    return measure;
+}
+
+static measure_t bench_getopt(const spec_t* spec, int argc, char** argv) {
+    size_t iterations = 0;
+    const double before = ALLOCATIONS();
+    const double start = now_ns();
+    double elapsed;
+    opterr = 0;
+    do {
+        // Resetting optind to zero makes glibc reinitialize completely.
+        optind = 0;
+        while (getopt_long(argc, argv, spec->optstring, spec->longopts,
+                           NULL) != -1) {}
+        iterations++;
+    } while ((elapsed = now_ns() - start) < BENCH_MIN_NS);
+    return (measure_t){
+        elapsed / iterations, (ALLOCATIONS() - before) / iterations
+    };
+}
+
+// The same loop through cmdapp's getopt_long front end, whose tables are
+// built on the first call and reused afterwards.
+static measure_t bench_shim(const spec_t* spec, int argc, char** argv) {
+    opterr = 0;
+    optind = 0;
+    while (cmdapp_getopt_long(argc, argv, spec->optstring, spec->longopts,
+                              NULL) != -1) {}
+    size_t iterations = 0;
+    const double before = ALLOCATIONS();
+    const double start = now_ns();
+    double elapsed;
+    do {
+        optind = 0;
+        while (cmdapp_getopt_long(argc, argv, spec->optstring, spec->longopts,
+                                  NULL) != -1) {}
+        iterations++;
+    } while ((elapsed = now_ns() - start) < BENCH_MIN_NS);
+    return (measure_t){
+        elapsed / iterations, (ALLOCATIONS() - before) / iterations
+    };
+}
+
+static measure_t bench_setup(const spec_t* spec) {
+    char* argv[] = { "bench", NULL };
+    size_t iterations = 0;
+    const double before = ALLOCATIONS();
+    const double start = now_ns();
+    double elapsed;
+    do {
+        cmdapp_t app;
+        const cmdapp_info_t info = { .program = "bench", .description = "" };
+        cmdapp_init(&app, 1, argv, CMDAPP_MODE_MULTIFLAG, &info);
+        spec_register(spec, &app);
+        cmdapp_run(&app);
+        cmdapp_destroy(&app);
+        iterations++;
+    } while ((elapsed = now_ns() - start) < BENCH_MIN_NS);
+    return (measure_t){
+        elapsed / iterations, (ALLOCATIONS() - before) / iterations
+    };
+}
+
+int main(int argc, char* argv[]) {
+    // Pass an argc limit, such as 10000, for quicker runs.
+    const size_t max_argc = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+    static const size_t spec_sizes[] = { 10, 100, 1000 };
+    static const size_t argcs[] = { 10, 100, 1000, 10000, 100000, 1000000 };
+
+    printf("%-8s %-12s %8s %14s %10s %14s %10s %14s %10s\n", "options",
+           "form", "argc", "cmdapp ns", "allocs", "getopt ns", "allocs",
+           "shim ns", "allocs");
+    for (size_t s = 0; s < sizeof(spec_sizes) / sizeof(*spec_sizes); s++) {
+        spec_t spec;
+        spec_init(&spec, spec_sizes[s]);
+        const measure_t setup = bench_setup(&spec);
+        printf("%-8zu %-12s %8s %14.0f %10.1f\n", spec.count, "setup", "-",
+               setup.ns, setup.allocations);
+        for (form_t form = 0; form < FORM_COUNT; form++) {
+            for (size_t a = 0; a < sizeof(argcs) / sizeof(*argcs); a++) {
+                if (argcs[a] > max_argc) break;
+                char* storage;
+                char** bench_argv = make_argv(&spec, form, argcs[a],
+                                              &storage);
+                const measure_t ours = bench_cmdapp(&spec, (int)argcs[a],
+                                                    bench_argv);
+                const measure_t theirs = bench_getopt(&spec, (int)argcs[a],
+                                                      bench_argv);
+                const measure_t shim = bench_shim(&spec, (int)argcs[a],
+                                                  bench_argv);
+                printf("%-8zu %-12s %8zu %14.0f %10.1f %14.0f %10.1f %14.0f "
+                       "%10.1f\n", spec.count, form_names[form], argcs[a],
+                       ours.ns, ours.allocations, theirs.ns,
+                       theirs.allocations, shim.ns, shim.allocations);
+                free(bench_argv);
+                free(storage);
+            }
+        }
+        cmdapp_getopt_release();
+        spec_destroy(&spec);
+    }
+    return 0;
+}
@@ -24,7 +24,7 @@ static void setup_options(cmdapp_t* app, cmdopt_t* file, cmdopt_t* eval) {
         app,
         'f',
         "file",
-        CMDOPT_TAKESARG,
+        CMDOPT_TAKESARG | CMDOPT_OPTIONAL,
         file_confl /* either accepts file or in-command text. */,
         "Does nothing with a file",
         file
@@ -33,7 +33,7 @@ static void setup_options(cmdapp_t* app, cmdopt_t* file, cmdopt_t* eval) {
         app,
         'e',
         "eval",
-        CMDOPT_TAKESARG,
+        CMDOPT_TAKESARG | CMDOPT_OPTIONAL,
         eval_confl /* either accepts file or in-command text. */,
         "Does nothing with a script",
         eval
@@ -77,7 +77,8 @@ int main(int argc, char* argv[]) {
         "This is free software: you are free to change and redistribute it.\n"
         "There is NO WARRANTY, to the extent permitted by law.\n"
     };
-    cmdapp_init(&app, argc, argv, CMDAPP_MODE_SHORTARG, &info);
+    cmdapp_init(&app, argc, argv, CMDAPP_MODE_SHORTARG | CMDAPP_MODE_PRINT,
+                &info);
     cmdapp_enable_procedure(&app, myproc, NULL);
     cmdopt_t file, eval;
     setup_options(&app, &file, &eval);
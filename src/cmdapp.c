@@ -18,22 +18,139 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdarg.h>
+#include <errno.h>
+#include <time.h>
+
+// https://stackoverflow.com/questions/11350878/how-can-i-determine-if-the-operating-system-is-posix-in-c
+#if defined(__unix__) || (defined(__APPLE__) && defined(__MACH__))
+#include <unistd.h>
+#endif
+
+#ifdef _POSIX_VERSION
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+extern char** environ;
+#endif /* _POSIX_VERSION */
 
 #define _COL_RED "\e[31;1m"
 #define _COL_RESET "\e[m"
-#define eprintf(fmt, ...) \
-    fprintf(stderr, _COL_RED "error:" _COL_RESET " " fmt, ##__VA_ARGS__);
+// Reports a cmdapp_load_config failure, unless the app is silent.
+#define eprintf(spec, fmt, ...) do { \
+        if ((spec)->_mode & CMDAPP_MODE_PRINT) { \
+            fprintf(stderr, _COL_RED "error:" _COL_RESET " " fmt, \
+                    ##__VA_ARGS__); \
+        } \
+    } while (0)
+
+// Instrumentation is compiled in unless CMDAPP_STATS is defined to zero, and
+// even then only costs a NULL check until cmdapp_enable_stats is called.
+#ifndef CMDAPP_STATS
+#define CMDAPP_STATS 1
+#endif
+
+#if CMDAPP_STATS
+#define _STAT(stats, field, n) do { \
+        if (stats) (stats)->field += (n); \
+    } while (0)
+#define _STAT_NOW(stats) ((stats) ? _cmdapp_now() : 0)
+
+static uint64_t _cmdapp_now(void) {
+    struct timespec ts;
+    #ifdef _POSIX_VERSION
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    #else
+    timespec_get(&ts, TIME_UTC);
+    #endif /* _POSIX_VERSION */
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+#else
+#define _STAT(stats, field, n) ((void)sizeof((stats)->field += (n)))
+#define _STAT_NOW(stats) ((void)(stats), (uint64_t)0)
+#endif /* CMDAPP_STATS */
+
+// All memory owned by an app goes through these so that it can come from a
+// caller-supplied arena instead of the heap. Fixed-size blocks are taken from
+// the top of the arena, leaving the bottom for the arrays that grow.
+static void* cmdapp_alloc(cmdapp_t* app, size_t size) {
+    cmdapp_arena_t* arena = &app->_arena;
+    _STAT(app->_stats, allocations, 1);
+    _STAT(app->_stats, allocated_bytes, size);
+    if (arena->_base == NULL) {
+        void* ptr = malloc(size);
+        if (ptr == NULL) app->_oom = true;
+        return ptr;
+    }
+    const size_t align = _Alignof(max_align_t);
+    if (size > arena->_top - arena->_used) {
+        app->_oom = true;
+        return NULL;
+    }
+    const size_t start = (arena->_top - size) & ~(align - 1);
+    if (start < arena->_used) {
+        app->_oom = true;
+        return NULL;
+    }
+    arena->_top = start;
+    return arena->_base + start;
+}
+
+static void* cmdapp_grow(cmdapp_t* app, void* ptr, size_t old_size,
+                         size_t new_size) {
+    cmdapp_arena_t* arena = &app->_arena;
+    _STAT(app->_stats, allocations, 1);
+    _STAT(app->_stats, allocated_bytes, new_size);
+    if (arena->_base == NULL) {
+        void* grown = realloc(ptr, new_size);
+        if (grown == NULL) app->_oom = true;
+        return grown;
+    }
+    // The most recent growable block can be extended in place.
+    if (ptr != NULL && ptr == arena->_base + arena->_last) {
+        if (new_size > arena->_top - arena->_last) {
+            app->_oom = true;
+            return NULL;
+        }
+        arena->_used = arena->_last + new_size;
+        return ptr;
+    }
+    const size_t align = _Alignof(max_align_t);
+    const size_t start = (arena->_used + align - 1) & ~(align - 1);
+    if (start > arena->_top || new_size > arena->_top - start) {
+        app->_oom = true;
+        return NULL;
+    }
+    arena->_last = start;
+    arena->_used = start + new_size;
+    if (ptr != NULL) {
+        memcpy(arena->_base + start, ptr, old_size);
+    }
+    return arena->_base + start;
+}
 
-typedef struct _cmdopt_internal_t {
-    // The option that this internal representation refers to
-    cmdopt_t* result;
+static void cmdapp_free(cmdapp_t* app, void* ptr) {
+    if (app->_arena._base == NULL) {
+        free(ptr);
+    }
+}
 
-    // Used for help and version generation
-    const char* description;
+// A block of the arguments that glob patterns expanded to.
+struct _cmdapp_block {
+    struct _cmdapp_block* next;
+    size_t size;
+    size_t used;
+    char data[];
+};
 
-    // NULL-terminated array
-    cmdopt_t* conflicts[];
-} cmdarg_internal_t;
+static void cmdapp_free_blocks(struct _cmdapp_block* block) {
+    while (block != NULL) {
+        struct _cmdapp_block* next = block->next;
+        free(block);
+        block = next;
+    }
+}
 
 static inline size_t _argvlen(void** argv) {
     size_t length = 0;
@@ -41,70 +158,368 @@ static inline size_t _argvlen(void** argv) {
     return length;
 }
 
-void cmdapp_init(cmdapp_t* app, int argc, char** argv, cmdapp_mode_t mode,
-                 const cmdapp_info_t* info) {
+static void cmdapp_init_common(cmdapp_t* app, int argc, char** argv,
+                               cmdapp_mode_t mode, const cmdapp_info_t* info) {
     app->_argc = argc;
     app->_argv = argv;
-    app->_mode = mode;
-    app->_custom_help = 0;
-    app->_custom_ver = 0;
-    app->_length = 0;
-    app->_capacity = 4;
-    app->_start = malloc(sizeof(cmdarg_internal_t*) * app->_capacity);
-    app->_args.length = 0;
-    app->_args.contents = NULL;
-    app->_info = *info;
+    cmdapp_spec_t* spec = &app->_spec;
+    spec->_mode = mode;
+    spec->_info = *info;
+    spec->_custom_help = 0;
+    spec->_custom_ver = 0;
+    spec->_length = 0;
+    spec->_capacity = 0;
+    spec->_start = NULL;
+    spec->_table = NULL;
+    spec->_static_length = 0;
+    spec->_index._built = false;
+    spec->_index._storage = NULL;
+    spec->_index._storage_owned = false;
+    spec->_index._long = NULL;
+    spec->_index._long_mask = 0;
+    spec->_index._keys = NULL;
+    spec->_index._flags = NULL;
+    spec->_index._masks = NULL;
+    spec->_index._env = NULL;
+    spec->_index._env_mask = 0;
+    spec->_index._sorted = NULL;
+    spec->_index._sorted_length = 0;
+    spec->_index._search = NULL;
+    spec->_config._base = NULL;
+    spec->_config._size = 0;
+    spec->_config._mapped = false;
+    app->_cache_dir = NULL;
+    app->_cache._base = NULL;
+    app->_cache._size = 0;
+    app->_cache._mapped = false;
+    spec->_config_values = NULL;
+    spec->_config_ids = NULL;
+    spec->_config_count = 0;
+    app->_result._spec = spec;
+    app->_result._owner = app;
+    app->_result._length = 0;
+    app->_result._exists = NULL;
+    app->_result._values = NULL;
+    app->_result._typed = NULL;
+    app->_result._occurrences = NULL;
+    app->_result._occurrences_length = 0;
+    app->_result._occurrences_capacity = 0;
+    app->_result._pieces = NULL;
+    app->_result._pieces_length = 0;
+    app->_result._pieces_capacity = 0;
+    app->_result._blocks = NULL;
+    app->_result._globbed = false;
+    app->_result._multi = NULL;
+    app->_result._multi_capacity = 0;
+    app->_result._multi_start = NULL;
+    app->_result._multi_count = NULL;
+    app->_result._touched = NULL;
+    app->_result._touched_length = 0;
+    app->_result._args.length = 0;
+    app->_result._args.contents = NULL;
+    app->_result._args_capacity = 0;
+    app->_result._args_from = 0;
+    app->_result._files = NULL;
+    app->_result._files_length = 0;
+    app->_result._files_capacity = 0;
+    app->_result._error.code = CMDAPP_OK;
+    app->_result._error_count = 0;
+    app->_result._exit = 0;
+    app->_result._stats = NULL;
     app->_proc = NULL;
+    app->_stats = NULL;
+    app->_arena._base = NULL;
+    app->_arena._size = 0;
+    app->_arena._used = 0;
+    app->_arena._last = 0;
+    app->_arena._top = 0;
+    app->_oom = false;
+    app->_subcommands = NULL;
+    app->_subcommands_length = 0;
+    app->_subcommands_capacity = 0;
+    app->_subcommand_slots = NULL;
+    app->_subcommand_mask = 0;
+    app->_selected = 0;
+    app->_base_length = 0;
+    app->_help = NULL;
+    app->_help_length = 0;
+    app->_help_program = 0;
+    app->_help_width = 0;
+    app->_help_stale = true;
+    app->_version = NULL;
+    app->_version_length = 0;
+    app->_arg_check = 0;
 }
 
-void cmdapp_destroy(cmdapp_t* app) {
-    for (size_t i = 0; i < app->_length; i++) {
-        free(app->_start[i]);
+static void cmdapp_check_reserved(cmdapp_spec_t* spec, const char* longo) {
+    if (longo == NULL) return;
+    if (strncmp(longo, "help", 5) == 0) {
+        spec->_custom_help = 1;
+    } else if (strncmp(longo, "version", 8) == 0) {
+        spec->_custom_ver = 1;
     }
-    free(app->_start);
-    free(app->_args.contents);
-    app->_args.contents = NULL;
 }
 
-static void cmdapp_append(cmdapp_t* app, cmdarg_internal_t* arg_int) {
-    if (app->_length + 1 > app->_capacity) {
-        app->_capacity += (app->_capacity / 2);
-        app->_start = realloc(app->_start,
-                              sizeof(cmdarg_internal_t*) * app->_capacity);
+void cmdapp_init(cmdapp_t* app, int argc, char** argv, cmdapp_mode_t mode,
+                 const cmdapp_info_t* info) {
+    cmdapp_init_common(app, argc, argv, mode, info);
+    app->_spec._capacity = 4;
+    app->_spec._start = cmdapp_grow(app, NULL, 0,
+                                    sizeof(cmdopt_desc_t)
+                                    * app->_spec._capacity);
+    if (app->_spec._start == NULL) {
+        app->_spec._capacity = 0;
     }
-    app->_start[app->_length++] = arg_int;
 }
 
-void cmdapp_set(cmdapp_t* app, char shorto, const char* longo, uint8_t flags,
-                cmdopt_t** conflicts, const char* description,
-                cmdopt_t* option)
-{
+void cmdapp_init_arena(cmdapp_t* app, void* buffer, size_t size, int argc,
+                       char** argv, cmdapp_mode_t mode,
+                       const cmdapp_info_t* info) {
+    cmdapp_init_common(app, argc, argv, mode, info);
+    app->_arena._base = buffer;
+    app->_arena._size = size;
+    app->_arena._top = size & ~(_Alignof(max_align_t) - 1);
+    app->_spec._capacity = 4;
+    app->_spec._start = cmdapp_grow(app, NULL, 0,
+                                    sizeof(cmdopt_desc_t)
+                                    * app->_spec._capacity);
+    if (app->_spec._start == NULL) {
+        app->_spec._capacity = 0;
+    }
+}
 
-    if (strncmp(longo, "help", 5) == 0) {
-        app->_custom_help = 1;
-    } else if (strncmp(longo, "version", 8) == 0) {
-        app->_custom_ver = 1;
+void cmdapp_init_static(cmdapp_t* app, int argc, char** argv,
+                        cmdapp_mode_t mode, const cmdapp_info_t* info,
+                        const cmdapp_table_t* table) {
+    cmdapp_init_common(app, argc, argv, mode, info);
+    cmdapp_spec_t* spec = &app->_spec;
+    spec->_table = table;
+    // The table is only read, so it is safe to drop the const here; the
+    // zero capacity makes cmdapp_set copy it before writing.
+    spec->_start = (cmdopt_desc_t*)table->options;
+    spec->_length = table->length;
+    spec->_static_length = table->length;
+    for (size_t i = 0; i < table->length; i++) {
+        const cmdopt_desc_t* desc = &table->options[i];
+        desc->result->shorto = desc->shorto;
+        desc->result->longo = desc->longo;
+        desc->result->flags = desc->flags;
+        desc->result->value = NULL;
+        desc->result->typed.u = 0;
+        desc->result->values = NULL;
+        desc->result->count = 0;
+        desc->result->_id = i;
+        cmdapp_check_reserved(spec, desc->longo);
+    }
+}
+
+static void cmdapp_result_close_files(cmdapp_result_t* result);
+static void cmdapp_unmap_file(cmdapp_file_t* file);
+
+void cmdapp_destroy(cmdapp_t* app) {
+    cmdapp_result_close_files(&app->_result);
+    cmdapp_unmap_file(&app->_spec._config);
+    cmdapp_unmap_file(&app->_cache);
+    if (app->_arena._base != NULL) {
+        // Everything was bump-allocated, so a reset releases it all.
+        app->_arena._used = 0;
+        app->_arena._last = 0;
+        app->_arena._top = app->_arena._size & ~(_Alignof(max_align_t) - 1);
+        app->_result._args.contents = NULL;
+        return;
+    }
+    cmdapp_spec_t* spec = &app->_spec;
+    if (spec->_capacity) {
+        // Conflict lists of entries copied from a static table are static.
+        for (size_t i = spec->_static_length; i < spec->_length; i++) {
+            free((void*)spec->_start[i].conflicts);
+        }
+        free(spec->_start);
+    }
+    if (spec->_index._storage_owned) {
+        free(spec->_index._storage);
+    }
+    free(spec->_config_values);
+    free(spec->_config_ids);
+    free(app->_subcommands);
+    free(app->_subcommand_slots);
+    free(app->_help);
+    free(app->_version);
+    free(app->_result._exists);
+    free(app->_result._values);
+    free(app->_result._typed);
+    free(app->_result._occurrences);
+    free(app->_result._pieces);
+    cmdapp_free_blocks(app->_result._blocks);
+    free(app->_result._multi);
+    free(app->_result._multi_start);
+    free(app->_result._multi_count);
+    free(app->_result._touched);
+    free(app->_result._args.contents);
+    free(app->_result._files);
+    app->_result._args.contents = NULL;
+}
+
+// Copies a static table before the first write to its descriptors.
+static bool cmdapp_own_options(cmdapp_t* app) {
+    cmdapp_spec_t* spec = &app->_spec;
+    if (spec->_capacity != 0) {
+        return true;
+    }
+    const size_t capacity = spec->_length + 4;
+    cmdopt_desc_t* start = cmdapp_grow(app, NULL, 0,
+                                       sizeof(cmdopt_desc_t) * capacity);
+    if (start == NULL) return false;
+    if (spec->_length) {
+        memcpy(start, spec->_start, sizeof(cmdopt_desc_t) * spec->_length);
+    }
+    spec->_start = start;
+    spec->_capacity = capacity;
+    return true;
+}
+
+static cmdopt_desc_t* cmdapp_append(cmdapp_t* app) {
+    cmdapp_spec_t* spec = &app->_spec;
+    if (!cmdapp_own_options(app)) {
+        return NULL;
+    } else if (spec->_length + 1 > spec->_capacity) {
+        const size_t capacity = spec->_capacity + (spec->_capacity / 2);
+        cmdopt_desc_t* start = cmdapp_grow(app, spec->_start,
+                                           sizeof(cmdopt_desc_t)
+                                           * spec->_capacity,
+                                           sizeof(cmdopt_desc_t) * capacity);
+        if (start == NULL) return NULL;
+        spec->_start = start;
+        spec->_capacity = capacity;
     }
+    spec->_index._built = false;
+    app->_help_stale = true;
+    return &spec->_start[spec->_length++];
+}
+
+void cmdapp_set(cmdapp_t* app, char shorto, const char* longo,
+                cmdopt_flags_t flags, cmdopt_t** conflicts,
+                const char* description, cmdopt_t* option)
+{
+    cmdapp_check_reserved(&app->_spec, longo);
 
     option->shorto = shorto;
     option->longo = longo;
     option->flags = flags;
     option->value = NULL;
-    const size_t conflict_count = (conflicts == NULL)
-                                      ? 1
-                                      : _argvlen((void**)conflicts) + 1;
-    const size_t size = sizeof(cmdarg_internal_t)
-                        + conflict_count * sizeof(cmdopt_t*);
-    cmdarg_internal_t* arg_int = malloc(size);
-    arg_int->result = option;
-    arg_int->description = description;
-    if (conflicts == NULL) {
-        arg_int->conflicts[0] = NULL;
-    } else {
-        memcpy(arg_int->conflicts, conflicts, conflict_count
-                                              * sizeof(cmdopt_t*));
+    option->typed.u = 0;
+    option->values = NULL;
+    option->count = 0;
+    option->_id = app->_spec._length;
+
+    cmdopt_desc_t* desc = cmdapp_append(app);
+    if (desc == NULL) return;
+    desc->shorto = shorto;
+    desc->longo = longo;
+    desc->flags = flags;
+    desc->description = description;
+    desc->result = option;
+    desc->env = NULL;
+    desc->ranged = false;
+    desc->handler = NULL;
+    desc->handler_data = NULL;
+    desc->check = 0;
+    desc->conflicts = NULL;
+    if (conflicts != NULL) {
+        const size_t conflict_count = _argvlen((void**)conflicts) + 1;
+        cmdopt_t** copy = cmdapp_alloc(app, conflict_count * sizeof(cmdopt_t*));
+        if (copy == NULL) {
+            app->_spec._length--;
+            return;
+        }
+        memcpy(copy, conflicts, conflict_count * sizeof(cmdopt_t*));
+        desc->conflicts = copy;
+    }
+}
+
+void cmdapp_set_env(cmdapp_t* app, cmdopt_t* option, const char* name) {
+    cmdapp_spec_t* spec = &app->_spec;
+    if (option->_id >= spec->_length
+        || spec->_start[option->_id].result != option
+        || !cmdapp_own_options(app)) {
+        return;
+    }
+    spec->_start[option->_id].env = name;
+    spec->_index._built = false;
+}
+
+void cmdapp_set_range(cmdapp_t* app, cmdopt_t* option, cmdopt_value_t min,
+                      cmdopt_value_t max) {
+    cmdapp_spec_t* spec = &app->_spec;
+    if (option->_id >= spec->_length
+        || spec->_start[option->_id].result != option
+        || !cmdapp_own_options(app)) {
+        return;
+    }
+    cmdopt_desc_t* desc = &spec->_start[option->_id];
+    desc->ranged = true;
+    desc->min = min;
+    desc->max = max;
+}
+
+void cmdapp_set_handler(cmdapp_t* app, cmdopt_t* option,
+                        cmdopt_handler_t handler, void* data) {
+    cmdapp_spec_t* spec = &app->_spec;
+    if (option->_id >= spec->_length
+        || spec->_start[option->_id].result != option
+        || !cmdapp_own_options(app)) {
+        return;
+    }
+    cmdopt_desc_t* desc = &spec->_start[option->_id];
+    desc->handler = handler;
+    desc->handler_data = data;
+}
+
+void cmdapp_set_check(cmdapp_t* app, cmdopt_t* option, cmdapp_check_t checks) {
+    cmdapp_spec_t* spec = &app->_spec;
+    if (option->_id >= spec->_length
+        || spec->_start[option->_id].result != option
+        || !cmdapp_own_options(app)) {
+        return;
+    }
+    spec->_start[option->_id].check = checks;
+}
+
+void cmdapp_set_arg_check(cmdapp_t* app, cmdapp_check_t checks) {
+    app->_arg_check = checks;
+}
+
+void cmdapp_add_subcommand(cmdapp_t* app, const char* name,
+                           const char* description, cmdapp_setup_t setup,
+                           void* user_data) {
+    if (app->_subcommands_length + 1 > app->_subcommands_capacity) {
+        const size_t old_cap = app->_subcommands_capacity;
+        const size_t capacity = old_cap ? old_cap * 2 : 8;
+        cmdapp_subcommand_t* subcommands
+            = cmdapp_grow(app, app->_subcommands,
+                          sizeof(cmdapp_subcommand_t) * old_cap,
+                          sizeof(cmdapp_subcommand_t) * capacity);
+        if (subcommands == NULL) {
+            app->_oom = true;
+            return;
+        }
+        app->_subcommands = subcommands;
+        app->_subcommands_capacity = capacity;
     }
-    cmdapp_append(app, arg_int);
+    cmdapp_subcommand_t* subcommand
+        = &app->_subcommands[app->_subcommands_length++];
+    subcommand->name = name;
+    subcommand->description = description;
+    subcommand->setup = setup;
+    subcommand->user_data = user_data;
+    // Rebuild the name table on the next run.
+    cmdapp_free(app, app->_subcommand_slots);
+    app->_subcommand_slots = NULL;
+    app->_help_stale = true;
+}
+
+const char* cmdapp_subcommand(const cmdapp_t* app) {
+    return app->_selected ? app->_subcommands[app->_selected - 1].name : NULL;
 }
 
 void cmdapp_enable_procedure(cmdapp_t* app, cmdapp_procedure_t proc, void *user_data) {
@@ -112,247 +527,3264 @@ void cmdapp_enable_procedure(cmdapp_t* app, cmdapp_procedure_t proc, void *user_
     app->_user_data = user_data;
 }
 
-void cmdapp_print_help(cmdapp_t* app) {
-    if (app->_info.synopses && *app->_info.synopses) {
-        printf("Usage: %s %s\n", app->_argv[0], *app->_info.synopses);
-        for (size_t i = 1; app->_info.synopses[i]; i++) {
-            printf("   or: %s %s\n", app->_argv[0], app->_info.synopses[i]);
+// Text rendered in two passes: the first only measures, with no room, and
+// the second writes into a buffer of exactly the measured size.
+typedef struct {
+    char* data;
+    size_t length;
+    size_t capacity;
+} cmdapp_text_t;
+
+static void cmdapp_text_put(cmdapp_text_t* text, const char* str,
+                            size_t length) {
+    if (text->length < text->capacity) {
+        const size_t room = text->capacity - text->length;
+        memcpy(text->data + text->length, str, length < room ? length : room);
+    }
+    text->length += length;
+}
+
+static void cmdapp_text_pad(cmdapp_text_t* text, size_t count) {
+    if (text->length < text->capacity) {
+        const size_t room = text->capacity - text->length;
+        memset(text->data + text->length, ' ', count < room ? count : room);
+    }
+    text->length += count;
+}
+
+static inline void cmdapp_text_puts(cmdapp_text_t* text, const char* str) {
+    cmdapp_text_put(text, str, strlen(str));
+}
+
+// The widths of the --help output: where descriptions start, and the
+// terminal width they are wrapped to.
+typedef struct {
+    size_t column;
+    size_t width;
+} cmdapp_layout_t;
+
+// Writes an option's flags as in `  -c, --name=ARG` and returns their width.
+static size_t cmdapp_put_flags(cmdapp_text_t* text, char shorto,
+                               const char* longo, cmdopt_flags_t flags) {
+    const size_t start = text->length;
+    if (shorto) {
+        const char name[] = { ' ', ' ', '-', shorto };
+        cmdapp_text_put(text, name, sizeof(name));
+    } else {
+        cmdapp_text_pad(text, 4);
+    }
+    if (longo) {
+        cmdapp_text_puts(text, shorto ? ", --" : "  --");
+        cmdapp_text_puts(text, longo);
+    }
+    if (flags & CMDOPT_TAKESARG) {
+        cmdapp_text_puts(text, "=ARG");
+    } else if (flags & CMDOPT_MAYTAKEARG) {
+        cmdapp_text_puts(text, "[=ARG]");
+    }
+    return text->length - start;
+}
+
+// Writes a description starting at the layout's column, on the next line if
+// the entry before it reaches that far, and wraps it between words.
+static void cmdapp_put_description(cmdapp_text_t* text,
+                                   const cmdapp_layout_t* layout,
+                                   size_t used, const char* description) {
+    if (used + 2 > layout->column) {
+        cmdapp_text_puts(text, "\n");
+        used = 0;
+    }
+    cmdapp_text_pad(text, layout->column - used);
+    // Too narrow a terminal is not worth wrapping for.
+    const size_t room = layout->width > layout->column + 20
+                        ? layout->width - layout->column : SIZE_MAX;
+    size_t line = 0;
+    for (const char* p = description ? description : ""; *p; ) {
+        if (*p == ' ' || *p == '\n') {
+            if (*p == '\n') line = room;
+            p++;
+            continue;
+        }
+        const size_t word = strcspn(p, " \n");
+        if (line && line + 1 + word > room) {
+            cmdapp_text_puts(text, "\n");
+            cmdapp_text_pad(text, layout->column);
+            line = 0;
+        } else if (line) {
+            cmdapp_text_puts(text, " ");
+            line++;
+        }
+        cmdapp_text_put(text, p, word);
+        line += word;
+        p += word;
+    }
+    cmdapp_text_puts(text, "\n");
+}
+
+static void cmdapp_render_help(const cmdapp_t* app, cmdapp_text_t* text,
+                               const cmdapp_layout_t* layout) {
+    const cmdapp_spec_t* spec = &app->_spec;
+    const char* program = app->_argv[0];
+    const cmdapp_subcommand_t* subcommand
+        = app->_selected ? &app->_subcommands[app->_selected - 1] : NULL;
+    cmdapp_text_puts(text, "Usage: ");
+    cmdapp_text_puts(text, program);
+    if (subcommand) {
+        cmdapp_text_puts(text, " ");
+        cmdapp_text_puts(text, subcommand->name);
+        cmdapp_text_puts(text, " [OPTION]... ARG...\n");
+    } else if (spec->_info.synopses && *spec->_info.synopses) {
+        for (size_t i = 0; spec->_info.synopses[i]; i++) {
+            if (i) {
+                cmdapp_text_puts(text, "   or: ");
+                cmdapp_text_puts(text, program);
+            }
+            cmdapp_text_puts(text, " ");
+            cmdapp_text_puts(text, spec->_info.synopses[i]);
+            cmdapp_text_puts(text, "\n");
         }
     } else {
-        printf("Usage: %s [OPTION]... ARG...\n", app->_argv[0]);
+        cmdapp_text_puts(text, " [OPTION]... ARG...\n");
+    }
+    cmdapp_text_puts(text, "\n");
+    const char* description = subcommand ? subcommand->description
+                                         : spec->_info.description;
+    cmdapp_text_puts(text, description ? description : "");
+    cmdapp_text_puts(text, "\n");
+    if (!subcommand && app->_subcommands_length) {
+        cmdapp_text_puts(text, "\nSubcommands:\n");
+        for (size_t i = 0; i < app->_subcommands_length; i++) {
+            cmdapp_text_puts(text, "  ");
+            cmdapp_text_puts(text, app->_subcommands[i].name);
+            cmdapp_put_description(text, layout,
+                                   2 + strlen(app->_subcommands[i].name),
+                                   app->_subcommands[i].description);
+        }
     }
-    printf("\n");
-    printf("%s\n", app->_info.description);
-    if (!app->_length)
+    if (!spec->_length) {
         return;
-    printf("\n");
-    printf("Options:\n");
-    for (size_t i = 0; i < app->_length; i++) {
-        cmdarg_internal_t* arg_int = app->_start[i];
-        printf("%*s%s\r", app->_info.help_des_offset, "", arg_int->description);
-        printf("  -%c", arg_int->result->shorto);
-        if (arg_int->result->longo) {
-            printf(", --%s", arg_int->result->longo);
+    }
+    cmdapp_text_puts(text, "\nOptions:\n");
+    for (size_t i = 0; i < spec->_length; i++) {
+        const cmdopt_desc_t* desc = &spec->_start[i];
+        const size_t used = cmdapp_put_flags(
+            text, desc->shorto, desc->longo,
+            cmdopt_implied_flags(desc->flags));
+        cmdapp_put_description(text, layout, used, desc->description);
+    }
+    if (!spec->_custom_help) {
+        const size_t used = cmdapp_put_flags(text, 0, "help", 0);
+        cmdapp_put_description(text, layout, used,
+                               "Display this information");
+    }
+    if (!spec->_custom_ver) {
+        const size_t used = cmdapp_put_flags(text, 0, "version", 0);
+        cmdapp_put_description(text, layout, used,
+                               "Display program version information");
+    }
+}
+
+// The width of the terminal on stdout, of $COLUMNS, or 80 for anything else.
+static size_t cmdapp_terminal_width(void) {
+    #if defined(_POSIX_VERSION) && defined(TIOCGWINSZ)
+    struct winsize size;
+    if (isatty(STDOUT_FILENO) && ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == 0
+        && size.ws_col) {
+        return size.ws_col;
+    }
+    #endif /* _POSIX_VERSION && TIOCGWINSZ */
+    const char* columns = getenv("COLUMNS");
+    if (columns != NULL) {
+        const long width = strtol(columns, NULL, 10);
+        if (width > 0) return (size_t)width;
+    }
+    return 80;
+}
+
+// Whether the help text of a generated table is what the app would render.
+static bool cmdapp_generated_help(const cmdapp_t* app, size_t width) {
+    const cmdapp_spec_t* spec = &app->_spec;
+    const cmdapp_table_t* table = spec->_table;
+    return table && table->help && table->info && !app->_selected
+           && !app->_subcommands_length
+           && spec->_length == spec->_static_length
+           && table->help_width == width
+           && spec->_info.description == table->info->description
+           && spec->_info.synopses == table->info->synopses
+           && spec->_info.help_des_offset == table->info->help_des_offset
+           && strcmp(app->_argv[0], table->info->program) == 0;
+}
+
+// Lines up descriptions just past the widest entry, or at help_des_offset if
+// that is further, but never past half of the terminal.
+static cmdapp_layout_t cmdapp_layout_help(const cmdapp_t* app, size_t width) {
+    const cmdapp_spec_t* spec = &app->_spec;
+    cmdapp_text_t measure = { NULL, 0, 0 };
+    size_t widest = 0;
+    for (size_t i = 0; i < spec->_length; i++) {
+        const cmdopt_desc_t* desc = &spec->_start[i];
+        measure.length = 0;
+        const size_t used = cmdapp_put_flags(
+            &measure, desc->shorto, desc->longo,
+            cmdopt_implied_flags(desc->flags));
+        if (used > widest) widest = used;
+    }
+    if (!app->_selected) {
+        for (size_t i = 0; i < app->_subcommands_length; i++) {
+            const size_t used = 2 + strlen(app->_subcommands[i].name);
+            if (used > widest) widest = used;
         }
-        if (arg_int->result->flags & CMDOPT_TAKESARG) {
-            printf("=ARG");
+    }
+    if (!spec->_custom_ver && widest < sizeof("      --version") - 1) {
+        widest = sizeof("      --version") - 1;
+    }
+    cmdapp_layout_t layout;
+    layout.width = width;
+    layout.column = widest + 2;
+    if (layout.column > width / 2) {
+        layout.column = width / 2;
+    }
+    if (spec->_info.help_des_offset > 0
+        && (size_t)spec->_info.help_des_offset > layout.column) {
+        layout.column = (size_t)spec->_info.help_des_offset;
+    }
+    return layout;
+}
+
+// Writes all of `length` bytes to stdout at once, after anything the program
+// left in the stdio buffer.
+static void cmdapp_write_stdout(const char* data, size_t length) {
+    fflush(stdout);
+    #ifdef _POSIX_VERSION
+    while (length) {
+        const ssize_t written = write(STDOUT_FILENO, data, length);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return;
         }
-        fputc('\n', stdout);
+        data += written;
+        length -= (size_t)written;
+    }
+    #else
+    fwrite(data, 1, length, stdout);
+    fflush(stdout);
+    #endif /* _POSIX_VERSION */
+}
+
+size_t cmdapp_format_help(cmdapp_t* app, char* buffer, size_t size,
+                          size_t width) {
+    if (width == 0) {
+        width = cmdapp_terminal_width();
+    }
+    const cmdapp_layout_t layout = cmdapp_layout_help(app, width);
+    cmdapp_text_t text = { buffer, 0, size ? size - 1 : 0 };
+    cmdapp_render_help(app, &text, &layout);
+    if (size) {
+        buffer[text.length < size ? text.length : size - 1] = 0;
     }
-    if (!app->_custom_help) {
-        printf("%*s%s\r  --help\n", app->_info.help_des_offset, "",
-               "Display this information");
+    return text.length;
+}
+
+// The help text is rendered once and kept until options or subcommands are
+// added, the terminal is resized, or the program is called by another name.
+// Generated tables come with it rendered already.
+void cmdapp_print_help(cmdapp_t* app) {
+    const char* program = app->_argv[0];
+    const size_t program_length = strlen(program);
+    const size_t width = cmdapp_terminal_width();
+    if (cmdapp_generated_help(app, width)) {
+        cmdapp_write_stdout(app->_spec._table->help,
+                            app->_spec._table->help_length);
+        return;
     }
-    if (!app->_custom_ver) {
-        printf("%*s%s\r  --version\n", app->_info.help_des_offset, "",
-               "Display program version information");
+    if (app->_help == NULL || app->_help_stale || app->_help_width != width
+        || app->_help_program != program_length
+        || memcmp(app->_help + 7, program, program_length) != 0) {
+        const cmdapp_layout_t layout = cmdapp_layout_help(app, width);
+        cmdapp_text_t text = { NULL, 0, 0 };
+        cmdapp_render_help(app, &text, &layout);
+        cmdapp_free(app, app->_help);
+        app->_help = cmdapp_alloc(app, text.length);
+        if (app->_help == NULL) {
+            return;
+        }
+        text.data = app->_help;
+        text.capacity = text.length;
+        text.length = 0;
+        cmdapp_render_help(app, &text, &layout);
+        app->_help_length = text.length;
+        app->_help_program = program_length;
+        app->_help_width = width;
+        app->_help_stale = false;
     }
+    cmdapp_write_stdout(app->_help, app->_help_length);
+}
+
+static void cmdapp_render_version(const cmdapp_info_t* info,
+                                  cmdapp_text_t* text) {
+    char year[24];
+    snprintf(year, sizeof(year), "%d", info->year);
+    cmdapp_text_puts(text, info->program);
+    cmdapp_text_puts(text, " ");
+    cmdapp_text_puts(text, info->version ? info->version : "");
+    cmdapp_text_puts(text, "\nCopyright (C) ");
+    cmdapp_text_puts(text, year);
+    cmdapp_text_puts(text, " ");
+    cmdapp_text_puts(text, info->author ? info->author : "");
+    cmdapp_text_puts(text, "\n");
+    cmdapp_text_puts(text, info->ver_extra ? info->ver_extra : "");
 }
 
 void cmdapp_print_version(cmdapp_t* app) {
-    printf("%s %s\n", app->_info.program, app->_info.version);
-    printf("Copyright (C) %d %s\n", app->_info.year, app->_info.author);
-    printf("%s", app->_info.ver_extra);
+    if (app->_version == NULL) {
+        cmdapp_text_t text = { NULL, 0, 0 };
+        cmdapp_render_version(&app->_spec._info, &text);
+        app->_version = cmdapp_alloc(app, text.length);
+        if (app->_version == NULL) {
+            return;
+        }
+        text.data = app->_version;
+        text.capacity = text.length;
+        text.length = 0;
+        cmdapp_render_version(&app->_spec._info, &text);
+        app->_version_length = text.length;
+    }
+    cmdapp_write_stdout(app->_version, app->_version_length);
 }
 
-static cmdarg_internal_t* cmdapp_search(cmdapp_t* app, char shorto, const char* longo) {
-    if (longo == NULL) {
-        for (size_t i = 0; i < app->_length; i++) {
-            if (app->_start[i]->result->shorto == shorto) {
-                return app->_start[i];
-            }
+// FNV-1a over the first `length` bytes of `str`, continuing from `hash`.
+static inline uint32_t _cmdapp_hash_from(uint32_t hash, const char* str,
+                                         size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char)str[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static inline uint32_t _cmdapp_hash(const char* str, size_t length) {
+    return _cmdapp_hash_from(2166136261u, str, length);
+}
+
+#define _BITSET_WORDS(n) (((n) + 63) / 64)
+#define _BITSET_TEST(set, i) (((set)[(i) / 64] >> ((i) % 64)) & 1)
+#define _BITSET_SET(set, i) ((set)[(i) / 64] |= (uint64_t)1 << ((i) % 64))
+
+// The index is carved out of one block of words. Apart from the long option
+// hash table it holds the hot per-option fields in parallel arrays, so that
+// lookups and validation never have to load an option's descriptor:
+//
+//   slots     uint32_t[slot_count]  long option hash table
+//   keys      uint64_t[length]      long name length << 32 | hash
+//   flags     cmdopt_flags_t[length]
+//   masks     uint64_t[words * (3 + rows)]
+//   env       uint32_t[env_slots]   environment variable hash table
+//   sorted    cmdopt_desc_t*[sorted_length]  long names in order
+//
+// The masks are the required set, the set of options with conflicts, the
+// number of options with conflicts before each word, and then one row per
+// option with conflicts holding the options it conflicts with.
+static size_t cmdapp_index_words(size_t slots, size_t length, size_t rows,
+                                 size_t env_slots, size_t sorted_length) {
+    return (slots + 1) / 2 + length
+           + (length * sizeof(cmdopt_flags_t) + 7) / 8
+           + _BITSET_WORDS(length) * (3 + rows) + (env_slots + 1) / 2
+           + sorted_length;
+}
+
+static int _cmdapp_compare_longo(const void* a, const void* b) {
+    const cmdopt_desc_t* const* x = a;
+    const cmdopt_desc_t* const* y = b;
+    const int order = strcmp((*x)->longo, (*y)->longo);
+    // Keep duplicates in registration order, so the first one comes first.
+    return order ? order : (*x < *y ? -1 : *x > *y);
+}
+
+static void cmdapp_build_masks(cmdapp_spec_t* spec) {
+    cmdapp_index_t* index = &spec->_index;
+    const size_t words = _BITSET_WORDS(spec->_length);
+    uint64_t* required = index->_masks;
+    uint64_t* has_conflicts = required + words;
+    uint64_t* before = has_conflicts + words;
+    uint64_t* row = before + words;
+    for (size_t i = 0; i < spec->_length; i++) {
+        const cmdopt_desc_t* desc = &spec->_start[i];
+        if (i % 64 == 0 && i) {
+            before[i / 64] = before[i / 64 - 1]
+                             + (uint64_t)__builtin_popcountll(
+                                   has_conflicts[i / 64 - 1]);
         }
-    } else {
-        for (size_t i = 0; i < app->_length; i++) {
-            if (strcmp(app->_start[i]->result->longo, longo) == 0) {
-                return app->_start[i];
+        if (!(desc->flags & CMDOPT_OPTIONAL)) {
+            _BITSET_SET(required, i);
+        }
+        if (!desc->conflicts || !desc->conflicts[0]) continue;
+        _BITSET_SET(has_conflicts, i);
+        for (size_t j = 0; desc->conflicts[j]; j++) {
+            // Conflicts with options that were never registered are ignored.
+            const size_t other = desc->conflicts[j]->_id;
+            if (other < spec->_length
+                && spec->_start[other].result == desc->conflicts[j]) {
+                _BITSET_SET(row, other);
             }
         }
+        row += words;
     }
-    return NULL;
 }
 
-#define IS_END_OF_FLAGS(str) \
-    ((str)[0] == '-' && (str)[1] == '-' && (str)[2] == 0)
-#define IS_LONG_FLAG(str) ((str)[0] == '-' && (str)[1] == '-')
-#define IS_SHORT_FLAG(str) ((str)[0] == '-')
+// Builds the short option table, the long option hash table, the hot field
+// arrays and the masks. Earlier registrations win on duplicates, as they did
+// with the linear scan.
+static void cmdapp_build_index(cmdapp_t* app) {
+    cmdapp_spec_t* spec = &app->_spec;
+    cmdapp_index_t* index = &spec->_index;
+    memset(index->_short, 0, sizeof(index->_short));
 
-static int cmdapp_resolve_options(cmdapp_t* app) {
-    for (size_t i = 0; i < app->_length; i++) {
-        cmdarg_internal_t* arg_int = app->_start[i];
-        if (!cmdopt_exists(*arg_int->result)) continue;
-        if (!cmdopt_is_optional(*arg_int->result)) {
-            eprintf("Required option -%c not passed\n",
-                    arg_int->result->shorto);
-            return EXIT_FAILURE;
+    // Keep the load factor at or below one half.
+    size_t slots = 8;
+    while (slots < spec->_length * 2) slots *= 2;
+    size_t rows = 0;
+    size_t bound = 0;
+    size_t named = 0;
+    for (size_t i = 0; i < spec->_length; i++) {
+        const cmdopt_desc_t* desc = &spec->_start[i];
+        if (desc->conflicts && desc->conflicts[0]) rows++;
+        if (desc->env) bound++;
+        if (desc->longo) named++;
+    }
+    const size_t sorted_length
+        = (spec->_mode & CMDAPP_MODE_ABBREV) ? named : 0;
+    size_t env_slots = 0;
+    if (bound) {
+        env_slots = 8;
+        while (env_slots < bound * 2) env_slots *= 2;
+    }
+    const size_t words = cmdapp_index_words(slots, spec->_length, rows,
+                                            env_slots, sorted_length);
+
+    if (index->_storage_owned) {
+        cmdapp_free(app, index->_storage);
+    }
+    if (spec->_table && spec->_table->storage_words >= words
+        && spec->_length == spec->_static_length) {
+        // Static tables bring their own storage.
+        index->_storage = spec->_table->storage;
+        index->_storage_owned = false;
+    } else {
+        index->_storage = cmdapp_alloc(app, words * sizeof(uint64_t));
+        index->_storage_owned = true;
+        if (index->_storage == NULL) return;
+    }
+    memset(index->_storage, 0, words * sizeof(uint64_t));
+    // A generated table still unchanged brings its lookup and masks.
+    const cmdapp_table_t* generated
+        = spec->_table && spec->_table->search_long
+          && spec->_length == spec->_static_length ? spec->_table : NULL;
+    index->_search = generated ? generated->search_long : NULL;
+    index->_keys = index->_storage + (slots + 1) / 2;
+    index->_flags = (cmdopt_flags_t*)(index->_keys + spec->_length);
+    index->_masks = index->_keys + spec->_length
+                    + (spec->_length * sizeof(cmdopt_flags_t) + 7) / 8;
+    index->_long = (uint32_t*)index->_storage;
+    index->_long_mask = slots - 1;
+    index->_env = (uint32_t*)(index->_masks
+                              + _BITSET_WORDS(spec->_length) * (3 + rows));
+    index->_env_mask = env_slots ? env_slots - 1 : 0;
+    index->_sorted = (const cmdopt_desc_t**)((uint64_t*)index->_env
+                                             + (env_slots + 1) / 2);
+    index->_sorted_length = sorted_length;
+    // The remaining regions are laid out past the built masks either way.
+    if (generated && generated->masks) {
+        index->_masks = (uint64_t*)generated->masks;
+    }
+
+    for (size_t i = 0; i < spec->_length; i++) {
+        const cmdopt_desc_t* desc = &spec->_start[i];
+        index->_flags[i] = cmdopt_implied_flags(desc->flags);
+        unsigned char shorto = (unsigned char)desc->shorto;
+        if (shorto && !index->_short[shorto]) {
+            index->_short[shorto] = (uint32_t)i + 1;
         }
-        cmdopt_t** conflicts = arg_int->conflicts;
-        if (!conflicts) continue;
-        for (size_t i = 0; conflicts[i]; i++) {
-            if (cmdopt_exists(*conflicts[i])) {
-                eprintf("Cannot pass both -%c and -%c\n",
-                        arg_int->result->shorto, conflicts[i]->shorto);
-                return EXIT_FAILURE;
+        if (desc->longo == NULL || index->_search) continue;
+        const size_t length = strlen(desc->longo);
+        const uint32_t hash = _cmdapp_hash(desc->longo, length);
+        index->_keys[i] = (uint64_t)length << 32 | hash;
+        size_t slot = hash & index->_long_mask;
+        for (;;) {
+            uint32_t entry = index->_long[slot];
+            if (entry == 0) {
+                index->_long[slot] = (uint32_t)i + 1;
+                break;
             }
+            if (index->_keys[entry - 1] == index->_keys[i]
+                && strcmp(spec->_start[entry - 1].longo, desc->longo) == 0) {
+                break;
+            }
+            slot = (slot + 1) & index->_long_mask;
         }
     }
-    return EXIT_SUCCESS;
+    for (size_t i = 0; env_slots && i < spec->_length; i++) {
+        const char* env = spec->_start[i].env;
+        if (env == NULL) continue;
+        size_t slot = _cmdapp_hash(env, strlen(env)) & index->_env_mask;
+        uint32_t entry;
+        while ((entry = index->_env[slot])
+               && strcmp(spec->_start[entry - 1].env, env) != 0) {
+            slot = (slot + 1) & index->_env_mask;
+        }
+        if (entry == 0) {
+            index->_env[slot] = (uint32_t)i + 1;
+        }
+    }
+    if (sorted_length) {
+        size_t k = 0;
+        for (size_t i = 0; i < spec->_length; i++) {
+            if (spec->_start[i].longo) index->_sorted[k++] = &spec->_start[i];
+        }
+        qsort(index->_sorted, sorted_length, sizeof(cmdopt_desc_t*),
+              _cmdapp_compare_longo);
+    }
+    if (!generated || !generated->masks) {
+        cmdapp_build_masks(spec);
+    }
+    index->_built = true;
 }
 
-int cmdapp_run(cmdapp_t* app) {
-    if (app->_args.contents != NULL) {
-        app->_args.contents = realloc(app->_args.contents, sizeof(char*) * 4);
-        app->_args.length = 0;
-    } else {
-        app->_args.contents = malloc(sizeof(char*) * 4);
-    }
-    size_t args_cap = 4;
-    #define APPEND_ARG(arg) if (app->_args.length + 1 > args_cap) { \
-        args_cap += (args_cap / 2); \
-        app->_args.contents = realloc(app->_args.contents, \
-                                      sizeof(char*) * args_cap); \
-    } \
-    if (app->_proc) { \
-        app->_proc(app->_user_data, NULL, arg); \
-    } \
-    app->_args.contents[app->_args.length++] = arg;
+// Returns the index plus one of the option with the given short name, or zero.
+static inline uint32_t cmdapp_search_short(const cmdapp_spec_t* spec,
+                                           char shorto,
+                                           cmdapp_stats_t* stats) {
+    _STAT(stats, lookups, 1);
+    _STAT(stats, probes, 1);
+    return spec->_index._short[(unsigned char)shorto];
+}
 
-    bool only_args = false;
-    for (int i = 0; i < app->_argc; i++) {
-        char* current = app->_argv[i];
-        if (only_args) {
-            APPEND_ARG(current);
-            continue;
-        }
-        const char* next = app->_argv[i + 1];
-        if (IS_END_OF_FLAGS(current)) {
-            only_args = true;
-            continue;
+// Returns the index plus one of the option named by the first `length` bytes
+// of `longo`, which need not be NUL-terminated there, or zero. Only a
+// matching length and hash leads to a comparison of the names.
+static uint32_t cmdapp_search_long(const cmdapp_spec_t* spec,
+                                   const char* longo, size_t length,
+                                   cmdapp_stats_t* stats) {
+    const cmdapp_index_t* index = &spec->_index;
+    if (index->_search) {
+        _STAT(stats, lookups, 1);
+        _STAT(stats, probes, 1);
+        return index->_search(longo, length);
+    }
+    const uint32_t hash = _cmdapp_hash(longo, length);
+    const uint64_t key = (uint64_t)length << 32 | hash;
+    size_t slot = hash & index->_long_mask;
+    _STAT(stats, lookups, 1);
+    for (uint32_t entry; (entry = index->_long[slot]); ) {
+        _STAT(stats, probes, 1);
+        if (index->_keys[entry - 1] == key
+            && memcmp(spec->_start[entry - 1].longo, longo, length) == 0) {
+            return entry;
         }
-        cmdarg_internal_t* arg_int;
-        if (IS_LONG_FLAG(current)) {
-            // Find the `=` for longopt args.
-            char* arg = strchr(current, '=');
-            // Move the pointer to the start of the longopt's args
-            if (arg) {
-                *arg = 0;
-                arg++;
-            }
+        slot = (slot + 1) & index->_long_mask;
+    }
+    return 0;
+}
 
-            if ((arg_int = cmdapp_search(app, 0, current + 2))) {
-                if (arg_int->result->flags & CMDOPT_TAKESARG) {
-                    if (arg == NULL) {
-                        eprintf("%s expects an argument\n", current);
-                        return EXIT_FAILURE;
-                    }
-                } else if (arg_int->result->flags & CMDOPT_MAYTAKEARG) {
-                    arg_int->result->value = arg;
-                } else {
-                    if (arg != NULL) {
-                        eprintf("%s does not take arguments\n", current);
-                        return EXIT_FAILURE;
-                    }
-                }
-            } else {
-                if (strncmp(current, "--help", 7) == 0) {
-                    cmdapp_print_help(app);
-                    app->_mode |= _CMDAPP_MODE_EXIT;
-                    return EXIT_SUCCESS;
-                } else if (strncmp(current, "--version", 10) == 0) {
-                    cmdapp_print_version(app);
-                    app->_mode |= _CMDAPP_MODE_EXIT;
-                    return EXIT_SUCCESS;
-                }
-                eprintf("Unrecognized command line option %s\n", current);
-                return EXIT_FAILURE;
-            }
-            arg_int->result->flags |= CMDOPT_EXISTS;
-            if (app->_proc) {
-                app->_proc(app->_user_data, arg_int->result, NULL);
-            }
-        } else if (IS_SHORT_FLAG(current)) {
-            if (app->_mode & CMDAPP_MODE_SHORTARG) {
-                if ((arg_int = cmdapp_search(app, current[1], NULL))) {
-                    arg_int->result->value = NULL;
-                    if (arg_int->result->flags | CMDOPT_TAKESARG) {
-                        arg_int->result->value = current + 2;
-                        if (!current[2] && next && next[0] != '-') {
-                            arg_int->result->value = next;
-                            i++;
-                        } else if (current[2] == 0) {
-                            eprintf("-%c expects an argument\n", current[1]);
-                            return EXIT_FAILURE;
-                        }
-                    } else if ((current[2] != 0) || (next && next[0] != '-')) {
-                        eprintf("-%c does not take arguments\n", current[1]);
-                        return EXIT_FAILURE;
-                    }
-                } else {
-                    eprintf("Unrecognized command line option -%c\n",
-                            current[1]);
-                    return EXIT_FAILURE;
-                }
-                arg_int->result->flags |= CMDOPT_EXISTS;
-                if (app->_proc) {
-                    app->_proc(app->_user_data, arg_int->result, NULL);
-                }
-            } else /* app->_mode | CMDAPP_MODE_MULTIFLAG */ {
-                for (size_t j = 1; current[j]; j++) {
-                    if ((arg_int = cmdapp_search(app, current[1], NULL))) {
-                        arg_int->result->value = current + 2;
-                        if (arg_int->result->value[2] == 0) {
-                            if (next && next[0] != '-') {
-                                arg_int->result->value = next;
-                                i++;
-                            } else {
-                                eprintf("-%c expects an argument\n", current[1]);
-                                return EXIT_FAILURE;
-                            }
-                        }
-                    } else {
-                        eprintf("Unrecognized command line option -%c\n",
-                                current[1]);
-                        return EXIT_FAILURE;
-                    }
-                }
-            }
+// Finds the run of sorted long names that begin with the first `length` bytes
+// of `prefix` with two binary searches. Sets `first` to its start and `run`
+// to its length, and returns the number of distinct names in it, but at most
+// two.
+static size_t cmdapp_search_prefix(const cmdapp_spec_t* spec,
+                                   const char* prefix, size_t length,
+                                   size_t* first, size_t* run) {
+    const cmdopt_desc_t* const* sorted = spec->_index._sorted;
+    size_t low = 0;
+    size_t high = spec->_index._sorted_length;
+    while (low < high) {
+        const size_t mid = low + (high - low) / 2;
+        if (strncmp(sorted[mid]->longo, prefix, length) < 0) {
+            low = mid + 1;
         } else {
-            APPEND_ARG(current);
+            high = mid;
         }
     }
-    #undef APPEND_ARG
+    *first = low;
+    high = spec->_index._sorted_length;
+    while (low < high) {
+        const size_t mid = low + (high - low) / 2;
+        if (strncmp(sorted[mid]->longo, prefix, length) <= 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    *run = low - *first;
+    if (*run > 1 && strcmp(sorted[*first]->longo, sorted[low - 1]->longo)) {
+        return 2;
+    }
+    return *run ? 1 : 0;
+}
 
-    if (cmdapp_resolve_options(app) != EXIT_SUCCESS) {
-        return EXIT_FAILURE;
+// Returns the index plus one of the option bound to the environment variable
+// named by the first `length` bytes of `name`, or zero.
+static uint32_t cmdapp_search_env(const cmdapp_spec_t* spec, const char* name,
+                                  size_t length, cmdapp_stats_t* stats) {
+    const cmdapp_index_t* index = &spec->_index;
+    size_t slot = _cmdapp_hash(name, length) & index->_env_mask;
+    _STAT(stats, lookups, 1);
+    for (uint32_t entry; (entry = index->_env[slot]); ) {
+        _STAT(stats, probes, 1);
+        const char* env = spec->_start[entry - 1].env;
+        if (strncmp(env, name, length) == 0 && env[length] == 0) {
+            return entry;
+        }
+        slot = (slot + 1) & index->_env_mask;
     }
+    return 0;
+}
 
-    return EXIT_SUCCESS;
+const cmdapp_spec_t* cmdapp_get_spec(cmdapp_t* app) {
+    if (!app->_spec._index._built) {
+        cmdapp_build_index(app);
+    }
+    return app->_oom ? NULL : &app->_spec;
 }
 
-cmdargs_t* cmdapp_getargs(cmdapp_t* app) {
-    if (app->_args.contents == NULL) {
-        return NULL;
+cmdapp_errcode_t cmdapp_find_long(const cmdapp_spec_t* spec, const char* name,
+                                  size_t length, size_t* id) {
+    uint32_t entry = cmdapp_search_long(spec, name, length, NULL);
+    if (!entry && length && (spec->_mode & CMDAPP_MODE_ABBREV)) {
+        size_t first, run;
+        switch (cmdapp_search_prefix(spec, name, length, &first, &run)) {
+            case 0:
+                break;
+            case 1:
+                entry = (uint32_t)(spec->_index._sorted[first]
+                                   - spec->_start) + 1;
+                break;
+            default:
+                return CMDAPP_ERR_AMBIGUOUS;
+        }
+    }
+    if (!entry) {
+        return CMDAPP_ERR_UNKNOWN;
     }
-    return &app->_args;
+    *id = entry - 1;
+    return CMDAPP_OK;
 }
 
-// https://stackoverflow.com/questions/11350878/how-can-i-determine-if-the-operating-system-is-posix-in-c
-#if defined(__unix__) || (defined(__APPLE__) && defined(__MACH__))
-#include <unistd.h>
-#endif
+// Forgets the options set by the previous parse. Only the options that parse
+// touched are visited, so the cost does not grow with the size of the spec.
+static void cmdapp_result_reset(cmdapp_result_t* result) {
+    const cmdapp_spec_t* spec = result->_spec;
+    for (size_t i = 0; i < result->_touched_length; i++) {
+        const size_t id = result->_touched[i];
+        result->_exists[id / 64] = 0;
+        if (result->_owner != NULL) {
+            spec->_start[id].result->flags &= ~CMDOPT_EXISTS;
+            spec->_start[id].result->value = NULL;
+            spec->_start[id].result->typed.u = 0;
+            spec->_start[id].result->values = NULL;
+            spec->_start[id].result->count = 0;
+        }
+        result->_multi_count[id] = 0;
+    }
+    result->_touched_length = 0;
+    result->_occurrences_length = 0;
+    result->_pieces_length = 0;
+    for (struct _cmdapp_block* block = result->_blocks; block != NULL;
+         block = block->next) {
+        block->used = 0;
+    }
+    result->_args.length = 0;
+    result->_args_from = 0;
+    result->_globbed = false;
+    result->_error.code = CMDAPP_OK;
+    result->_error_count = 0;
+    result->_exit = 0;
+    cmdapp_result_close_files(result);
+}
 
-void cmdapp_error(cmdapp_t* app, const char* fmt, ...) {
-    #ifdef _POSIX_VERSION
-    if (isatty(STDERR_FILENO) || (getenv("CMDAPP_COLOR_ALWAYS") != NULL)) {
-        fprintf(stderr, "%s: " _COL_RED "error: " _COL_RESET,
-                app->_info.program);
+// Sizes the per-option arrays of a result for its spec.
+static int cmdapp_result_reserve(cmdapp_result_t* result) {
+    const size_t length = result->_spec->_length;
+    if (result->_exists != NULL && result->_length == length) {
+        return EXIT_SUCCESS;
+    }
+    if (result->_exists != NULL) {
+        cmdapp_result_reset(result);
+    }
+    const size_t words = _BITSET_WORDS(length) ? _BITSET_WORDS(length) : 1;
+    const size_t values = length ? length : 1;
+    cmdapp_t* owner = result->_owner;
+    if (owner != NULL) {
+        cmdapp_free(owner, result->_exists);
+        cmdapp_free(owner, result->_values);
+        cmdapp_free(owner, result->_typed);
+        cmdapp_free(owner, result->_multi_start);
+        cmdapp_free(owner, result->_multi_count);
+        cmdapp_free(owner, result->_touched);
+        result->_exists = cmdapp_alloc(owner, words * sizeof(uint64_t));
+        result->_values = cmdapp_alloc(owner, values * sizeof(char*));
+        result->_typed = cmdapp_alloc(owner, values * sizeof(cmdopt_value_t));
+        result->_multi_start = cmdapp_alloc(owner, values * sizeof(size_t));
+        result->_multi_count = cmdapp_alloc(owner, values * sizeof(size_t));
+        result->_touched = cmdapp_alloc(owner, values * sizeof(size_t));
     } else {
-        fprintf(stderr, "%s: error: ", app->_info.program);
+        free(result->_exists);
+        free(result->_values);
+        free(result->_typed);
+        free(result->_multi_start);
+        free(result->_multi_count);
+        free(result->_touched);
+        result->_exists = malloc(words * sizeof(uint64_t));
+        result->_values = malloc(values * sizeof(char*));
+        result->_typed = malloc(values * sizeof(cmdopt_value_t));
+        result->_multi_start = malloc(values * sizeof(size_t));
+        result->_multi_count = malloc(values * sizeof(size_t));
+        result->_touched = malloc(values * sizeof(size_t));
+        _STAT(result->_stats, allocations, 6);
+        _STAT(result->_stats, allocated_bytes,
+              words * sizeof(uint64_t) + values * sizeof(char*)
+              + values * sizeof(cmdopt_value_t) + 3 * values * sizeof(size_t));
     }
-    #else
-    fprintf(stderr, "%s: error: ", app->_info.program);
-    #endif /* _POSIX_VERSION */
-    va_list valist;
+    if (result->_exists == NULL || result->_values == NULL
+        || result->_typed == NULL || result->_multi_start == NULL
+        || result->_multi_count == NULL || result->_touched == NULL) {
+        result->_length = 0;
+        return EXIT_FAILURE;
+    }
+    memset(result->_exists, 0, words * sizeof(uint64_t));
+    memset(result->_multi_count, 0, values * sizeof(size_t));
+    result->_length = length;
+    return EXIT_SUCCESS;
+}
+
+int cmdapp_result_init(cmdapp_result_t* result, const cmdapp_spec_t* spec) {
+    result->_spec = spec;
+    result->_owner = NULL;
+    result->_length = 0;
+    result->_exists = NULL;
+    result->_values = NULL;
+    result->_typed = NULL;
+    result->_occurrences = NULL;
+    result->_occurrences_length = 0;
+    result->_occurrences_capacity = 0;
+    result->_pieces = NULL;
+    result->_pieces_length = 0;
+    result->_pieces_capacity = 0;
+    result->_blocks = NULL;
+    result->_globbed = false;
+    result->_multi = NULL;
+    result->_multi_capacity = 0;
+    result->_multi_start = NULL;
+    result->_multi_count = NULL;
+    result->_touched = NULL;
+    result->_touched_length = 0;
+    result->_args.length = 0;
+    result->_args.contents = NULL;
+    result->_args_capacity = 0;
+    result->_args_from = 0;
+    result->_files = NULL;
+    result->_files_length = 0;
+    result->_files_capacity = 0;
+    result->_error.code = CMDAPP_OK;
+    result->_error_count = 0;
+    result->_exit = 0;
+    result->_stats = NULL;
+    return cmdapp_result_reserve(result);
+}
+
+void cmdapp_result_destroy(cmdapp_result_t* result) {
+    cmdapp_result_close_files(result);
+    free(result->_exists);
+    free(result->_values);
+    free(result->_typed);
+    free(result->_occurrences);
+    free(result->_pieces);
+    cmdapp_free_blocks(result->_blocks);
+    free(result->_multi);
+    free(result->_multi_start);
+    free(result->_multi_count);
+    free(result->_touched);
+    free(result->_args.contents);
+    free(result->_files);
+    result->_exists = NULL;
+    result->_values = NULL;
+    result->_occurrences = NULL;
+    result->_pieces = NULL;
+    result->_blocks = NULL;
+    result->_globbed = false;
+    result->_multi = NULL;
+    result->_touched = NULL;
+    result->_args.contents = NULL;
+    result->_files = NULL;
+}
+
+// Grows one of the result's arrays with its owner's allocator, or the heap.
+static void* cmdapp_result_grow(cmdapp_result_t* result, void* ptr,
+                                size_t old_size, size_t new_size) {
+    if (result->_owner != NULL) {
+        return cmdapp_grow(result->_owner, ptr, old_size, new_size);
+    }
+    _STAT(result->_stats, allocations, 1);
+    _STAT(result->_stats, allocated_bytes, new_size);
+    return realloc(ptr, new_size);
+}
+
+static int cmdapp_result_append(cmdapp_result_t* result, const char* arg) {
+    if (result->_args.length + 1 > result->_args_capacity) {
+        const size_t old_cap = result->_args_capacity;
+        const size_t args_cap = old_cap ? old_cap + (old_cap / 2) : 4;
+        const char** contents
+            = cmdapp_result_grow(result, result->_args.contents,
+                                 sizeof(char*) * old_cap,
+                                 sizeof(char*) * args_cap);
+        if (contents == NULL) {
+            return EXIT_FAILURE;
+        }
+        result->_args.contents = contents;
+        result->_args_capacity = args_cap;
+    }
+    result->_args.contents[result->_args.length++] = arg;
+    return EXIT_SUCCESS;
+}
+
+// Copies a string into the result's blocks, which never move, so that it can
+// be kept among the arguments.
+static const char* cmdapp_result_store(cmdapp_result_t* result,
+                                       const char* str, size_t length) {
+    struct _cmdapp_block* block = result->_blocks;
+    while (block != NULL && block->size - block->used < length + 1) {
+        block = block->next;
+    }
+    if (block == NULL) {
+        // Each new block at least doubles the space, and goes in front.
+        size_t size = result->_blocks ? result->_blocks->size * 2 : 4096;
+        if (size < length + 1) size = length + 1;
+        block = cmdapp_result_grow(result, NULL, 0,
+                                   sizeof(struct _cmdapp_block) + size);
+        if (block == NULL) {
+            return NULL;
+        }
+        block->next = result->_blocks;
+        block->size = size;
+        block->used = 0;
+        result->_blocks = block;
+    }
+    char* copy = block->data + block->used;
+    memcpy(copy, str, length);
+    copy[length] = 0;
+    block->used += length + 1;
+    return copy;
+}
+
+// One occurrence of a CMDOPT_MULTI option. The pieces of a split value live
+// in the result's piece buffer, which may move as it grows, so they are kept
+// as offsets until the parse is over.
+struct _cmdapp_occurrence {
+    size_t id;
+    const char* value;
+    size_t piece;
+};
+
+#define _CMDAPP_NO_PIECE SIZE_MAX
+
+static int cmdapp_result_occur(cmdapp_result_t* result, size_t id,
+                               const char* value, size_t piece) {
+    if (result->_occurrences_length + 1 > result->_occurrences_capacity) {
+        const size_t old_cap = result->_occurrences_capacity;
+        const size_t new_cap = old_cap ? old_cap + (old_cap / 2) : 8;
+        struct _cmdapp_occurrence* occurrences
+            = cmdapp_result_grow(result, result->_occurrences,
+                                 sizeof(*occurrences) * old_cap,
+                                 sizeof(*occurrences) * new_cap);
+        if (occurrences == NULL) {
+            return EXIT_FAILURE;
+        }
+        result->_occurrences = occurrences;
+        result->_occurrences_capacity = new_cap;
+    }
+    result->_occurrences[result->_occurrences_length++]
+        = (struct _cmdapp_occurrence){ id, value, piece };
+    return EXIT_SUCCESS;
+}
+
+// Records an occurrence of a CMDOPT_MULTI option. A CMDOPT_SPLIT value with
+// commas is copied once into the piece buffer with its commas turned into
+// terminators, since argv is never written; any other value is kept as is.
+static int cmdapp_result_collect(cmdapp_result_t* result, size_t id,
+                                 const char* value) {
+    const cmdopt_flags_t split = CMDOPT_SPLIT & ~CMDOPT_MULTI;
+    if (value == NULL || !(result->_spec->_index._flags[id] & split)
+        || strchr(value, ',') == NULL) {
+        return cmdapp_result_occur(result, id, value, _CMDAPP_NO_PIECE);
+    }
+    const size_t length = strlen(value) + 1;
+    if (result->_pieces_length + length > result->_pieces_capacity) {
+        const size_t old_cap = result->_pieces_capacity;
+        size_t new_cap = old_cap ? old_cap * 2 : 64;
+        while (new_cap < result->_pieces_length + length) new_cap *= 2;
+        char* pieces = cmdapp_result_grow(result, result->_pieces, old_cap,
+                                          new_cap);
+        if (pieces == NULL) {
+            return EXIT_FAILURE;
+        }
+        result->_pieces = pieces;
+        result->_pieces_capacity = new_cap;
+    }
+    char* copy = result->_pieces + result->_pieces_length;
+    memcpy(copy, value, length);
+    size_t start = result->_pieces_length;
+    for (size_t k = 0; k < length; k++) {
+        if (copy[k] == ',' || copy[k] == 0) {
+            copy[k] = 0;
+            if (cmdapp_result_occur(result, id, NULL, start) != EXIT_SUCCESS) {
+                return EXIT_FAILURE;
+            }
+            start = result->_pieces_length + k + 1;
+        }
+    }
+    result->_pieces_length += length;
+    return EXIT_SUCCESS;
+}
+
+// Gathers the occurrences of every CMDOPT_MULTI option into one array with a
+// counting sort, so that each option's values are contiguous and in order.
+static int cmdapp_result_group(cmdapp_result_t* result) {
+    const size_t total = result->_occurrences_length;
+    if (total > result->_multi_capacity) {
+        const char** multi
+            = cmdapp_result_grow(result, result->_multi,
+                                 sizeof(char*) * result->_multi_capacity,
+                                 sizeof(char*) * total);
+        if (multi == NULL) {
+            return EXIT_FAILURE;
+        }
+        result->_multi = multi;
+        result->_multi_capacity = total;
+    }
+    for (size_t k = 0; k < total; k++) {
+        result->_multi_count[result->_occurrences[k].id]++;
+    }
+    size_t start = 0;
+    for (size_t k = 0; k < result->_touched_length; k++) {
+        const size_t id = result->_touched[k];
+        result->_multi_start[id] = start;
+        start += result->_multi_count[id];
+        result->_multi_count[id] = 0;
+    }
+    for (size_t k = 0; k < total; k++) {
+        const struct _cmdapp_occurrence* occurrence = &result->_occurrences[k];
+        const size_t id = occurrence->id;
+        result->_multi[result->_multi_start[id] + result->_multi_count[id]++]
+            = occurrence->piece == _CMDAPP_NO_PIECE
+              ? occurrence->value : result->_pieces + occurrence->piece;
+    }
+    return EXIT_SUCCESS;
+}
+
+bool cmdapp_result_exists(const cmdapp_result_t* result,
+                          const cmdopt_t* option) {
+    return option->_id < result->_length
+           && _BITSET_TEST(result->_exists, option->_id);
+}
+
+const char* cmdapp_result_value(const cmdapp_result_t* result,
+                                const cmdopt_t* option) {
+    return cmdapp_result_exists(result, option)
+           ? result->_values[option->_id] : NULL;
+}
+
+int64_t cmdapp_result_int(const cmdapp_result_t* result,
+                          const cmdopt_t* option) {
+    return cmdapp_result_exists(result, option)
+           ? result->_typed[option->_id].i : 0;
+}
+
+uint64_t cmdapp_result_uint(const cmdapp_result_t* result,
+                            const cmdopt_t* option) {
+    return cmdapp_result_exists(result, option)
+           ? result->_typed[option->_id].u : 0;
+}
+
+double cmdapp_result_double(const cmdapp_result_t* result,
+                            const cmdopt_t* option) {
+    return cmdapp_result_exists(result, option)
+           ? result->_typed[option->_id].d : 0;
+}
+
+bool cmdapp_result_bool(const cmdapp_result_t* result,
+                        const cmdopt_t* option) {
+    return cmdapp_result_exists(result, option)
+           && result->_typed[option->_id].b;
+}
+
+const char* const* cmdapp_result_values(const cmdapp_result_t* result,
+                                        const cmdopt_t* option,
+                                        size_t* count) {
+    if (!cmdapp_result_exists(result, option)) {
+        *count = 0;
+        return NULL;
+    }
+    *count = result->_multi_count[option->_id];
+    return result->_multi + result->_multi_start[option->_id];
+}
+
+const cmdargs_t* cmdapp_result_args(const cmdapp_result_t* result) {
+    return &result->_args;
+}
+
+const cmdapp_err_t* cmdapp_result_error(const cmdapp_result_t* result) {
+    return result->_error.code == CMDAPP_OK ? NULL : &result->_error;
+}
+
+const cmdapp_err_t* cmdapp_result_errors(const cmdapp_result_t* result,
+                                         size_t* count) {
+    if (result->_error_count) {
+        *count = result->_error_count;
+        return result->_errors;
+    }
+    *count = result->_error.code == CMDAPP_OK ? 0 : 1;
+    return &result->_error;
+}
+
+size_t cmdapp_format_error(const cmdapp_spec_t* spec,
+                           const cmdapp_err_t* error, char* buffer,
+                           size_t size) {
+    const cmdopt_desc_t* options = spec->_start;
+    // Short flags are recorded as their single character, long flags in full.
+    const int length = (int)error->length;
+    const char* dash = length == 1 ? "-" : "";
+    size_t used = 0;
+    #define APPEND(...) do { \
+        const int written_ = snprintf(used < size ? buffer + used : NULL, \
+                                      used < size ? size - used : 0, \
+                                      __VA_ARGS__); \
+        if (written_ > 0) used += (size_t)written_; \
+    } while (0)
+    if (size) buffer[0] = 0;
+    switch (error->code) {
+        case CMDAPP_OK:
+            break;
+        case CMDAPP_ERR_NOMEM:
+            APPEND("Out of memory");
+            break;
+        case CMDAPP_ERR_UNKNOWN:
+            APPEND("Unrecognized command line option %s%.*s", dash, length,
+                   error->text);
+            break;
+        case CMDAPP_ERR_EXPECTS_ARG:
+            APPEND("%s%.*s expects an argument", dash, length, error->text);
+            break;
+        case CMDAPP_ERR_NO_ARG:
+            APPEND("%s%.*s does not take arguments", dash, length,
+                   error->text);
+            break;
+        case CMDAPP_ERR_REQUIRED:
+            APPEND("Required option -%c not passed",
+                   options[error->option].shorto);
+            break;
+        case CMDAPP_ERR_CONFLICT:
+            APPEND("Cannot pass both -%c and -%c",
+                   options[error->option].shorto,
+                   options[error->other].shorto);
+            break;
+        case CMDAPP_ERR_RESPONSE:
+            APPEND("Cannot read response file %.*s", length - 1,
+                   error->text + 1);
+            break;
+        case CMDAPP_ERR_RESPONSE_DEPTH:
+            APPEND("Response files nested too deeply at %.*s", length,
+                   error->text);
+            break;
+        case CMDAPP_ERR_INVALID:
+            APPEND("Invalid value %.*s for -%c", length, error->text,
+                   options[error->option].shorto);
+            break;
+        case CMDAPP_ERR_RANGE:
+            APPEND("Value %.*s for -%c is out of range", length,
+                   error->text, options[error->option].shorto);
+            break;
+        case CMDAPP_ERR_PATH:
+            if (error->option == SIZE_MAX) {
+                APPEND("Cannot use %.*s: %s", length, error->text,
+                       strerror(error->path_errno));
+            } else {
+                APPEND("Cannot use %.*s for -%c: %s", length, error->text,
+                       options[error->option].shorto,
+                       strerror(error->path_errno));
+            }
+            break;
+        case CMDAPP_ERR_AMBIGUOUS: {
+            const cmdopt_desc_t* const* sorted
+                = spec->_index._sorted + error->candidates;
+            APPEND("Option %.*s is ambiguous; possibilities:", length,
+                   error->text);
+            for (size_t i = 0; i < error->candidate_count; i++) {
+                if (i == 0 || strcmp(sorted[i]->longo, sorted[i - 1]->longo)) {
+                    APPEND(" --%s", sorted[i]->longo);
+                }
+            }
+            APPEND("%s%s", error->help_candidate ? " --help" : "",
+                   error->version_candidate ? " --version" : "");
+            break;
+        }
+    }
+    #undef APPEND
+    return used;
+}
+
+// Prints every error of the app's last parse, each in a single write.
+static void cmdapp_print_errors(cmdapp_t* app) {
+    size_t count;
+    const cmdapp_err_t* errors = cmdapp_result_errors(&app->_result, &count);
+    for (size_t i = 0; i < count; i++) {
+        char message[512];
+        cmdapp_format_error(&app->_spec, &errors[i], message,
+                            sizeof(message));
+        cmdapp_error(app, "%s\n", message);
+    }
+}
+
+static inline bool _cmdapp_isspace(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v'
+           || c == '\f';
+}
+
+// Splits a response file into arguments in place, packing them one after
+// another with NUL terminators, which takes at most one byte past the end of
+// the buffer. Whitespace separates arguments, quotes group them, and a
+// backslash escapes the next character anywhere but within single quotes.
+// Returns the number of arguments.
+static size_t cmdapp_tokenize(char* buffer, size_t size) {
+    const char* read = buffer;
+    const char* end = buffer + size;
+    char* write = buffer;
+    size_t count = 0;
+    for (;;) {
+        while (read < end && _cmdapp_isspace(*read)) read++;
+        if (read == end) {
+            return count;
+        }
+        char quote = 0;
+        while (read < end && (quote || !_cmdapp_isspace(*read))) {
+            const char c = *read++;
+            if (c == quote) {
+                quote = 0;
+            } else if (!quote && (c == '\'' || c == '"')) {
+                quote = c;
+            } else if (c == '\\' && quote != '\'' && read < end) {
+                *write++ = *read++;
+            } else {
+                *write++ = c;
+            }
+        }
+        // Step over the separator first: the terminator may land on it.
+        if (read < end) read++;
+        *write++ = 0;
+        count++;
+    }
+}
+
+// Reads the whole of an open file into a buffer with a spare byte at the end.
+static char* cmdapp_read_file(int fd, FILE* stream, size_t size) {
+    char* buffer = malloc(size + 1);
+    if (buffer == NULL) {
+        return NULL;
+    }
+    size_t done = 0;
+    while (done < size) {
+        size_t count;
+        #ifdef _POSIX_VERSION
+        (void)stream;
+        const ssize_t got = read(fd, buffer + done, size - done);
+        count = got > 0 ? (size_t)got : 0;
+        #else
+        (void)fd;
+        count = fread(buffer + done, 1, size - done, stream);
+        #endif /* _POSIX_VERSION */
+        if (count == 0) {
+            break;
+        }
+        done += count;
+    }
+    if (done < size) {
+        free(buffer);
+        return NULL;
+    }
+    return buffer;
+}
+
+// A run of consecutive NUL-terminated tokens in a response file.
+typedef struct {
+    const char* next;
+    size_t remaining;
+} cmdapp_source_t;
+
+#ifdef _POSIX_VERSION
+static inline int64_t _cmdapp_mtime(const struct stat* info) {
+    #if defined(__APPLE__)
+    const struct timespec* mtime = &info->st_mtimespec;
+    #else
+    const struct timespec* mtime = &info->st_mtim;
+    #endif
+    return (int64_t)mtime->tv_sec * 1000000000 + mtime->tv_nsec;
+}
+#endif /* _POSIX_VERSION */
+
+// Maps the file at `path` privately, so that it may be rewritten in place
+// without copying it or changing it on disk, or reads it into a buffer where
+// it cannot be mapped. Either way one writable byte follows the contents.
+// Empty files are left without a base.
+static cmdapp_errcode_t cmdapp_map_file(const char* path,
+                                        cmdapp_file_t* file) {
+    file->_base = NULL;
+    file->_size = 0;
+    file->_mapped = false;
+    file->_path = path;
+    file->_mtime = 0;
+
+    #ifdef _POSIX_VERSION
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return CMDAPP_ERR_RESPONSE;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)) {
+        close(fd);
+        return CMDAPP_ERR_RESPONSE;
+    }
+    file->_size = (size_t)info.st_size;
+    file->_mtime = _cmdapp_mtime(&info);
+    // The rest of the last page of a mapping reads as zeroes and may be
+    // written, giving the spare byte, unless the file ends exactly at a page
+    // boundary.
+    const long page = sysconf(_SC_PAGESIZE);
+    if (file->_size > 0 && page > 0 && file->_size % (size_t)page != 0) {
+        void* base = mmap(NULL, file->_size, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE, fd, 0);
+        if (base != MAP_FAILED) {
+            file->_base = base;
+            file->_mapped = true;
+        }
+    }
+    if (file->_base == NULL && file->_size > 0) {
+        file->_base = cmdapp_read_file(fd, NULL, file->_size);
+    }
+    close(fd);
+    #else
+    FILE* stream = fopen(path, "rb");
+    if (stream == NULL) {
+        return CMDAPP_ERR_RESPONSE;
+    }
+    long size = -1;
+    if (fseek(stream, 0, SEEK_END) == 0) {
+        size = ftell(stream);
+        rewind(stream);
+    }
+    if (size < 0) {
+        fclose(stream);
+        return CMDAPP_ERR_RESPONSE;
+    }
+    file->_size = (size_t)size;
+    if (file->_size > 0) {
+        file->_base = cmdapp_read_file(-1, stream, file->_size);
+    }
+    fclose(stream);
+    #endif /* _POSIX_VERSION */
+
+    if (file->_size > 0 && file->_base == NULL) {
+        return CMDAPP_ERR_RESPONSE;
+    }
+    return CMDAPP_OK;
+}
+
+static void cmdapp_unmap_file(cmdapp_file_t* file) {
+    #ifdef _POSIX_VERSION
+    if (file->_mapped) {
+        munmap(file->_base, file->_size);
+        file->_base = NULL;
+        return;
+    }
+    #endif /* _POSIX_VERSION */
+    free(file->_base);
+    file->_base = NULL;
+}
+
+// Releases the response files read by the last parse.
+static void cmdapp_result_close_files(cmdapp_result_t* result) {
+    for (size_t i = 0; i < result->_files_length; i++) {
+        cmdapp_unmap_file(&result->_files[i]);
+    }
+    result->_files_length = 0;
+}
+
+// Opens the response file at `path`, records it in the result and tokenises
+// it into `source`.
+static cmdapp_errcode_t cmdapp_open_response(cmdapp_result_t* result,
+                                             const char* path,
+                                             cmdapp_source_t* source) {
+    if (result->_files_length == result->_files_capacity) {
+        const size_t old_cap = result->_files_capacity;
+        const size_t files_cap = old_cap ? old_cap * 2 : 4;
+        cmdapp_file_t* files
+            = cmdapp_result_grow(result, result->_files,
+                                 sizeof(cmdapp_file_t) * old_cap,
+                                 sizeof(cmdapp_file_t) * files_cap);
+        if (files == NULL) {
+            return CMDAPP_ERR_NOMEM;
+        }
+        result->_files = files;
+        result->_files_capacity = files_cap;
+    }
+    cmdapp_file_t* file = &result->_files[result->_files_length];
+    const cmdapp_errcode_t code = cmdapp_map_file(path, file);
+    source->next = file->_base;
+    source->remaining = 0;
+    if (code != CMDAPP_OK) {
+        return code;
+    }
+    // Empty files are kept too, so that caches notice when they fill up.
+    result->_files_length++;
+    if (file->_base == NULL) {
+        return CMDAPP_OK;
+    }
+    if (!file->_mapped) {
+        _STAT(result->_stats, allocations, 1);
+        _STAT(result->_stats, allocated_bytes, file->_size + 1);
+    }
+    source->remaining = cmdapp_tokenize(file->_base, file->_size);
+    return CMDAPP_OK;
+}
+
+static inline bool _cmdapp_word(const char* str, size_t length,
+                                const char* word) {
+    return strlen(word) == length && strncmp(str, word, length) == 0;
+}
+
+// The value of a config key set without one, which a run passes on as NULL
+// the way it does a bare option on the command line.
+static const char _cmdapp_config_set[] = "";
+
+// Parses the lines of a config file in place, terminating the values where
+// they end, into the value of each option. Returns zero on success or the
+// number of the offending line, having printed what is wrong with it.
+static size_t cmdapp_parse_config(const cmdapp_spec_t* spec,
+                                  const char* path, char* buffer,
+                                  size_t size, const char** values) {
+    char* const end = buffer + size;
+    size_t number = 0;
+    for (char* line = buffer; line < end; ) {
+        number++;
+        char* eol = memchr(line, '\n', (size_t)(end - line));
+        if (eol == NULL) eol = end;
+        char* first = line;
+        char* last = eol;
+        line = eol + 1;
+        while (first < last && _cmdapp_isspace(*first)) first++;
+        while (last > first && _cmdapp_isspace(last[-1])) last--;
+        if (first == last || *first == '#' || *first == ';'
+            || *first == '[') {
+            continue;
+        }
+        char* equals = memchr(first, '=', (size_t)(last - first));
+        char* key_end = equals ? equals : last;
+        while (key_end > first && _cmdapp_isspace(key_end[-1])) key_end--;
+        const size_t key_length = (size_t)(key_end - first);
+        char* value = NULL;
+        size_t value_length = 0;
+        if (equals) {
+            value = equals + 1;
+            while (value < last && _cmdapp_isspace(*value)) value++;
+            if (last - value >= 2 && *value == '"' && last[-1] == '"') {
+                value++;
+                last--;
+            }
+            // The line ends at a newline or, on the last line, at the spare
+            // byte past the file.
+            *last = 0;
+            value_length = (size_t)(last - value);
+        }
+
+        const uint32_t entry = cmdapp_search_long(spec, first, key_length,
+                                                  NULL);
+        if (entry == 0) {
+            eprintf(spec, "%s:%zu: Unrecognized option %.*s\n", path,
+                    number, (int)key_length, first);
+            return number;
+        }
+        const size_t id = entry - 1;
+        const cmdopt_flags_t flags = spec->_index._flags[id];
+        if (flags & CMDOPT_TAKESARG) {
+            if (value_length == 0) {
+                eprintf(spec, "%s:%zu: %.*s expects an argument\n", path,
+                        number, (int)key_length, first);
+                return number;
+            }
+            values[id] = value;
+        } else if (flags & CMDOPT_MAYTAKEARG) {
+            values[id] = value ? value : _cmdapp_config_set;
+        } else if (value == NULL || _cmdapp_word(value, value_length, "true")
+                   || _cmdapp_word(value, value_length, "yes")
+                   || _cmdapp_word(value, value_length, "on")
+                   || _cmdapp_word(value, value_length, "1")) {
+            values[id] = _cmdapp_config_set;
+        } else if (_cmdapp_word(value, value_length, "false")
+                   || _cmdapp_word(value, value_length, "no")
+                   || _cmdapp_word(value, value_length, "off")
+                   || _cmdapp_word(value, value_length, "0")) {
+            values[id] = NULL;
+        } else {
+            eprintf(spec, "%s:%zu: %.*s does not take arguments\n", path,
+                    number, (int)key_length, first);
+            return number;
+        }
+    }
+    return 0;
+}
+
+int cmdapp_load_config(cmdapp_t* app, const char* path) {
+    cmdapp_spec_t* spec = &app->_spec;
+    if (cmdapp_get_spec(app) == NULL) {
+        eprintf(spec, "Out of memory\n");
+        return EXIT_FAILURE;
+    }
+    cmdapp_file_t file;
+    if (cmdapp_map_file(path, &file) != CMDAPP_OK) {
+        eprintf(spec, "Cannot read config file %s\n", path);
+        return EXIT_FAILURE;
+    }
+    const size_t length = spec->_length ? spec->_length : 1;
+    const char** values = cmdapp_alloc(app, length * sizeof(char*));
+    size_t* ids = cmdapp_alloc(app, length * sizeof(size_t));
+    if (values == NULL || ids == NULL) {
+        cmdapp_free(app, values);
+        cmdapp_free(app, ids);
+        cmdapp_unmap_file(&file);
+        eprintf(spec, "Out of memory\n");
+        return EXIT_FAILURE;
+    }
+    memset(values, 0, length * sizeof(char*));
+    if (file._base != NULL
+        && cmdapp_parse_config(spec, path, file._base, file._size, values)) {
+        cmdapp_free(app, values);
+        cmdapp_free(app, ids);
+        cmdapp_unmap_file(&file);
+        return EXIT_FAILURE;
+    }
+
+    cmdapp_unmap_file(&spec->_config);
+    cmdapp_free(app, spec->_config_values);
+    cmdapp_free(app, spec->_config_ids);
+    spec->_config = file;
+    spec->_config_values = values;
+    spec->_config_ids = ids;
+    spec->_config_count = 0;
+    for (size_t id = 0; id < spec->_length; id++) {
+        if (values[id] != NULL) {
+            ids[spec->_config_count++] = id;
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+// How many argv entries the cursor classifies at a time.
+#define CMDAPP_SCAN_BLOCK 256
+
+// Reading a whole word at an aligned address never crosses into another
+// page, so the scanner may look past a token's terminator. AddressSanitizer
+// cannot know that.
+#if defined(__has_attribute)
+#if __has_attribute(no_sanitize_address)
+#define _CMDAPP_WORDWISE __attribute__((no_sanitize_address))
+#endif
+#endif
+#ifndef _CMDAPP_WORDWISE
+#define _CMDAPP_WORDWISE
+#endif
+
+typedef enum {
+    CMDAPP_TOKEN_ARG,
+    // `-x...`; a lone `-` is an ordinary argument, conventionally stdin
+    CMDAPP_TOKEN_SHORT,
+    CMDAPP_TOKEN_LONG,
+    // `--` on its own
+    CMDAPP_TOKEN_END,
+    // `@path`
+    CMDAPP_TOKEN_RESPONSE
+} cmdapp_token_kind_t;
+
+// What the pre-scan tells the parser about a token.
+typedef struct {
+    cmdapp_token_kind_t kind;
+    // For long options, the offset of the first `=` or else of the
+    // terminator, which is all the parser needs to know about their length.
+    // Other tokens are never measured.
+    size_t span;
+} cmdapp_token_t;
+
+// Marks each NUL byte of a word with its top bit, without false positives.
+#define _HIGHS ((uint64_t)0x7f7f7f7f7f7f7f7f)
+#define _ZERO_BYTES(word) (~((((word) & _HIGHS) + _HIGHS) | (word) | _HIGHS))
+#define _EQUALS ((uint64_t)0x3d3d3d3d3d3d3d3d)
+
+// Returns the offset of the first `=` or NUL in `str`, reading aligned words
+// and locating the byte with a count of trailing zeros.
+_CMDAPP_WORDWISE
+static size_t cmdapp_scan_name(const char* str) {
+    #if defined(__GNUC__) && defined(__BYTE_ORDER__) \
+        && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    const char* p = (const char*)((uintptr_t)str & ~(uintptr_t)7);
+    uint64_t word;
+    memcpy(&word, p, sizeof(word));
+    // The bytes before the token read as 0xff, neither NUL nor `=`.
+    word |= ((uint64_t)1 << (str - p) * 8) - 1;
+    for (;;) {
+        const uint64_t hits = _ZERO_BYTES(word) | _ZERO_BYTES(word ^ _EQUALS);
+        if (hits) {
+            return (size_t)(p + __builtin_ctzll(hits) / 8 - str);
+        }
+        p += sizeof(word);
+        memcpy(&word, p, sizeof(word));
+    }
+    #else
+    const char* p = str;
+    while (*p && *p != '=') p++;
+    return (size_t)(p - str);
+    #endif
+}
+
+static inline void cmdapp_classify(const char* str, cmdapp_token_t* token) {
+    token->span = 0;
+    if (str[0] == '-' && str[1] == '-') {
+        if (str[2]) {
+            token->kind = CMDAPP_TOKEN_LONG;
+            token->span = 2 + cmdapp_scan_name(str + 2);
+        } else {
+            token->kind = CMDAPP_TOKEN_END;
+        }
+    } else if (str[0] == '-' && str[1]) {
+        token->kind = CMDAPP_TOKEN_SHORT;
+    } else if (str[0] == '@' && str[1]) {
+        token->kind = CMDAPP_TOKEN_RESPONSE;
+    } else {
+        token->kind = CMDAPP_TOKEN_ARG;
+    }
+}
+
+// The tokens of a parse: the argument vector, interrupted by the contents of
+// each response file it names.
+typedef struct {
+    char* const* argv;
+    int argc;
+    // The next argv entry to read
+    int position;
+    // The argv entry the last token came from, directly or by response file
+    int index;
+    bool expand;
+    size_t depth;
+    cmdapp_source_t files[CMDAPP_RESPONSE_DEPTH];
+    // The classification of argv[scan_start, scan_start + scan_length),
+    // refilled a block at a time so the dispatch loop never rescans bytes
+    int scan_start;
+    int scan_length;
+    cmdapp_token_t scan[CMDAPP_SCAN_BLOCK];
+    // The classification of the current response file token
+    cmdapp_token_t file_token;
+    // The token last found by cmdapp_cursor_peek, valid until the next peek
+    const cmdapp_token_t* token;
+} cmdapp_cursor_t;
+
+static void cmdapp_cursor_init(cmdapp_cursor_t* cursor, int argc,
+                               char* const* argv, bool expand) {
+    cursor->argv = argv;
+    cursor->argc = argc;
+    cursor->position = 0;
+    cursor->index = 0;
+    cursor->expand = expand;
+    cursor->depth = 0;
+    cursor->scan_start = 0;
+    cursor->scan_length = 0;
+}
+
+// Classifies the next block of argv in one tight pass.
+static void cmdapp_cursor_scan(cmdapp_cursor_t* cursor) {
+    const int start = cursor->position;
+    int length = cursor->argc - start;
+    if (length > CMDAPP_SCAN_BLOCK) {
+        length = CMDAPP_SCAN_BLOCK;
+    }
+    for (int k = 0; k < length; k++) {
+        cmdapp_classify(cursor->argv[start + k], &cursor->scan[k]);
+    }
+    cursor->scan_start = start;
+    cursor->scan_length = length;
+}
+
+// Moves past the token returned by the last peek.
+static inline void cmdapp_cursor_skip(cmdapp_cursor_t* cursor) {
+    if (cursor->depth == 0) {
+        cursor->index = cursor->position++;
+    } else {
+        cmdapp_source_t* top = &cursor->files[cursor->depth - 1];
+        top->next += strlen(top->next) + 1;
+        top->remaining--;
+    }
+}
+
+// The slow path of cmdapp_cursor_peek: refills the scan block and reads
+// response files.
+static cmdapp_errcode_t cmdapp_cursor_fill(cmdapp_cursor_t* cursor,
+                                           cmdapp_result_t* result,
+                                           const char** token) {
+    for (;;) {
+        const char* head;
+        if (cursor->depth == 0) {
+            if (cursor->position >= cursor->argc) {
+                *token = NULL;
+                return CMDAPP_OK;
+            }
+            if (cursor->position - cursor->scan_start
+                >= cursor->scan_length) {
+                cmdapp_cursor_scan(cursor);
+            }
+            head = cursor->argv[cursor->position];
+            cursor->token = &cursor->scan[cursor->position
+                                          - cursor->scan_start];
+        } else {
+            cmdapp_source_t* top = &cursor->files[cursor->depth - 1];
+            if (top->remaining == 0) {
+                cursor->depth--;
+                continue;
+            }
+            head = top->next;
+            cmdapp_classify(head, &cursor->file_token);
+            cursor->token = &cursor->file_token;
+        }
+        *token = head;
+        if (!cursor->expand || cursor->token->kind != CMDAPP_TOKEN_RESPONSE) {
+            return CMDAPP_OK;
+        }
+        cmdapp_cursor_skip(cursor);
+        if (cursor->depth == CMDAPP_RESPONSE_DEPTH) {
+            return CMDAPP_ERR_RESPONSE_DEPTH;
+        }
+        const cmdapp_errcode_t code = cmdapp_open_response(
+            result, head + 1, &cursor->files[cursor->depth]);
+        if (code != CMDAPP_OK) {
+            return code;
+        }
+        cursor->depth++;
+    }
+}
+
+// Finds the next token without consuming it, or NULL at the end, opening any
+// response files in the way. On failure, `token` is the offending `@path`.
+static inline cmdapp_errcode_t cmdapp_cursor_peek(cmdapp_cursor_t* cursor,
+                                                  cmdapp_result_t* result,
+                                                  const char** token) {
+    const int k = cursor->position - cursor->scan_start;
+    if (cursor->depth == 0 && k < cursor->scan_length
+        && (!cursor->expand
+            || cursor->scan[k].kind != CMDAPP_TOKEN_RESPONSE)) {
+        // An argv entry from the current block.
+        cursor->token = &cursor->scan[k];
+        *token = cursor->argv[cursor->position];
+        return CMDAPP_OK;
+    }
+    return cmdapp_cursor_fill(cursor, result, token);
+}
+
+// Returns the mask of options the given option conflicts with, or NULL if it
+// has no conflicts.
+static const uint64_t* cmdapp_conflict_row(const cmdapp_spec_t* spec,
+                                           size_t id) {
+    const size_t words = _BITSET_WORDS(spec->_length);
+    const uint64_t* has_conflicts = spec->_index._masks + words;
+    const uint64_t* before = has_conflicts + words;
+    const uint64_t* rows = before + words;
+    if (!_BITSET_TEST(has_conflicts, id)) {
+        return NULL;
+    }
+    const uint64_t below = ((uint64_t)1 << (id % 64)) - 1;
+    const size_t rank = before[id / 64]
+        + (size_t)__builtin_popcountll(has_conflicts[id / 64] & below);
+    return rows + rank * words;
+}
+
+// Returns true if the option conflicts either way with one of the first
+// `count` options set by the parse so far.
+static bool cmdapp_conflicts_with_set(const cmdapp_spec_t* spec,
+                                      const cmdapp_result_t* result,
+                                      size_t id, size_t count) {
+    const uint64_t* row = cmdapp_conflict_row(spec, id);
+    for (size_t i = 0; i < count; i++) {
+        const size_t other = result->_touched[i];
+        const uint64_t* other_row = cmdapp_conflict_row(spec, other);
+        if ((row && _BITSET_TEST(row, other))
+            || (other_row && _BITSET_TEST(other_row, id))) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Returns true if a converted value lies outside its option's bounds.
+static bool cmdapp_out_of_range(const cmdopt_desc_t* desc,
+                                cmdopt_value_t value) {
+    if (!desc->ranged) {
+        return false;
+    }
+    switch (desc->flags & CMDOPT_TYPE_MASK) {
+        case CMDOPT_INT:
+            return value.i < desc->min.i || value.i > desc->max.i;
+        case CMDOPT_DOUBLE:
+            return !(value.d >= desc->min.d && value.d <= desc->max.d);
+        case CMDOPT_BOOL:
+            return false;
+        default:
+            return value.u < desc->min.u || value.u > desc->max.u;
+    }
+}
+
+// Keeps a copy of the error just recorded in the result under
+// CMDAPP_MODE_COLLECT. Returns whether the parse should carry on, which it
+// does until the result is full.
+static bool cmdapp_result_keep(cmdapp_result_t* result) {
+    if (!(result->_spec->_mode & CMDAPP_MODE_COLLECT)) {
+        return false;
+    }
+    if (result->_error_count < CMDAPP_MAX_ERRORS) {
+        result->_errors[result->_error_count++] = result->_error;
+    }
+    return result->_error_count < CMDAPP_MAX_ERRORS;
+}
+
+static inline bool cmdapp_result_reject(cmdapp_result_t* result,
+                                        cmdapp_errcode_t code, int index,
+                                        const char* text, size_t length) {
+    result->_error.code = code;
+    result->_error.index = index;
+    result->_error.text = text;
+    result->_error.length = length;
+    return cmdapp_result_keep(result);
+}
+
+// Checks the parsed options against the compiled masks: every required
+// option must exist, and no existing option may conflict with another. Fails
+// as well if errors were collected before.
+static int cmdapp_resolve_options(const cmdapp_spec_t* spec,
+                                  cmdapp_result_t* result) {
+    const size_t words = _BITSET_WORDS(spec->_length);
+    const uint64_t* exists = result->_exists;
+    const uint64_t* required = spec->_index._masks;
+    const uint64_t* has_conflicts = required + words;
+
+    result->_error.index = -1;
+    for (size_t w = 0; w < words; w++) {
+        for (uint64_t missing = required[w] & ~exists[w]; missing;
+             missing &= missing - 1) {
+            result->_error.code = CMDAPP_ERR_REQUIRED;
+            result->_error.option = w * 64 + __builtin_ctzll(missing);
+            if (!cmdapp_result_keep(result)) return EXIT_FAILURE;
+        }
+    }
+    for (size_t w = 0; w < words; w++) {
+        for (uint64_t bits = exists[w] & has_conflicts[w]; bits;
+             bits &= bits - 1) {
+            const size_t id = w * 64 + __builtin_ctzll(bits);
+            const uint64_t* row = cmdapp_conflict_row(spec, id);
+            for (size_t v = 0; v < words; v++) {
+                for (uint64_t hits = row[v] & exists[v]; hits;
+                     hits &= hits - 1) {
+                    const size_t other = v * 64 + __builtin_ctzll(hits);
+                    // A conflict declared both ways was already reported by
+                    // the earlier option.
+                    const uint64_t* other_row = cmdapp_conflict_row(spec,
+                                                                    other);
+                    if (other < id && other_row
+                        && _BITSET_TEST(other_row, id)) {
+                        continue;
+                    }
+                    result->_error.code = CMDAPP_ERR_CONFLICT;
+                    result->_error.option = id;
+                    result->_error.other = other;
+                    if (!cmdapp_result_keep(result)) return EXIT_FAILURE;
+                }
+            }
+        }
+    }
+    return result->_error_count ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+// Groups the values of repeated options by option. Their single value is the
+// last one collected, the last piece if split.
+static int cmdapp_apply_groups(const cmdapp_spec_t* spec,
+                               cmdapp_result_t* result, cmdapp_t* app) {
+    if (result->_occurrences_length == 0) {
+        return EXIT_SUCCESS;
+    }
+    if (cmdapp_result_group(result) != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+    for (size_t k = 0; k < result->_touched_length; k++) {
+        const size_t id = result->_touched[k];
+        const size_t count = result->_multi_count[id];
+        if (count == 0) continue;
+        const char* const* values = result->_multi + result->_multi_start[id];
+        result->_values[id] = values[count - 1];
+        if (app) {
+            cmdopt_t* option = spec->_start[id].result;
+            option->value = values[count - 1];
+            option->values = values;
+            option->count = count;
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+// Where the matches of a glob pattern among the arguments go.
+typedef struct {
+    cmdapp_result_t* result;
+    cmdapp_t* app;
+    bool stream;
+    size_t matches;
+    bool failed;
+} cmdapp_expansion_t;
+
+static bool cmdapp_expand_match(void* data, const char* path, size_t length) {
+    cmdapp_expansion_t* expansion = data;
+    cmdapp_result_t* result = expansion->result;
+    cmdapp_t* app = expansion->app;
+    expansion->matches++;
+    // Streamed matches go straight to the procedure without being kept.
+    const char* arg = expansion->stream
+                      ? path : cmdapp_result_store(result, path, length);
+    if (arg == NULL) {
+        expansion->failed = true;
+        return false;
+    }
+    if (app && app->_proc) {
+        app->_proc(app->_user_data, NULL, arg);
+        _STAT(result->_stats, callbacks, 1);
+    }
+    if (!expansion->stream
+        && cmdapp_result_append(result, arg) != EXIT_SUCCESS) {
+        expansion->failed = true;
+        return false;
+    }
+    return true;
+}
+
+// Hands out the paths matched by the argument `pattern` as arguments, and
+// sets `matches` to their number. Returns EXIT_FAILURE if out of memory.
+static int cmdapp_expand_arg(cmdapp_result_t* result, cmdapp_t* app,
+                             const char* pattern, bool stream,
+                             size_t* matches) {
+    cmdapp_expansion_t expansion = { result, app, stream, 0, false };
+    const int status = cmdapp_glob(pattern, 0, cmdapp_expand_match,
+                                   &expansion);
+    *matches = expansion.matches;
+    return status != EXIT_SUCCESS || expansion.failed
+           ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+// Returns whether `next` can be the separate argument of an option with the
+// given flags: anything that is not an option, or a negative number for a
+// signed type.
+static inline bool _cmdapp_is_value(const char* next, cmdopt_flags_t flags) {
+    if (next == NULL) {
+        return false;
+    }
+    if (next[0] != '-') {
+        return true;
+    }
+    const cmdopt_flags_t type = flags & CMDOPT_TYPE_MASK;
+    const char* digits = next[1] == '.' ? next + 2 : next + 1;
+    return (type == CMDOPT_INT || type == CMDOPT_DOUBLE)
+           && *digits >= '0' && *digits <= '9';
+}
+
+// The parser shared by cmdapp_run and cmdapp_parse. It never writes to argv
+// or the spec. When `app` is non-NULL the user-side options are updated and
+// the procedure is called as parsing proceeds, and --help and --version are
+// printed; otherwise only the result is written.
+static int cmdapp_parse_argv(const cmdapp_spec_t* spec, int argc,
+                             char* const* argv, cmdapp_result_t* result,
+                             cmdapp_t* app) {
+    cmdapp_result_reset(result);
+    cmdapp_stats_t* const stats = result->_stats;
+    const uint64_t parse_start = _STAT_NOW(stats);
+    uint64_t lookup_ns = 0;
+
+    #define STOP() do { \
+        _STAT(stats, tokenize_ns, _STAT_NOW(stats) - parse_start - lookup_ns); \
+        _STAT(stats, lookup_ns, lookup_ns); \
+        if (result->_error_count) result->_error = result->_errors[0]; \
+        return EXIT_FAILURE; \
+    } while (0)
+    #define FAIL(code_, index_, text_, length_) do { \
+        cmdapp_result_reject(result, (code_), (index_), (text_), (length_)); \
+        STOP(); \
+    } while (0)
+    // An error that leaves the rest of argv intact. Under CMDAPP_MODE_COLLECT
+    // the parse moves on to the next entry of the enclosing loop.
+    #define REJECT(code_, index_, text_, length_) \
+        if (cmdapp_result_reject(result, (code_), (index_), (text_), \
+                                 (length_))) \
+            continue; \
+        else STOP()
+    // A handler asked to stop: the rest of argv is left unread and nothing
+    // is validated, but repeated options still get their values grouped.
+    #define HALT() do { \
+        if (cmdapp_apply_groups(spec, result, app) != EXIT_SUCCESS) { \
+            FAIL(CMDAPP_ERR_NOMEM, -1, NULL, 0); \
+        } \
+        _STAT(stats, tokenize_ns, _STAT_NOW(stats) - parse_start - lookup_ns); \
+        _STAT(stats, lookup_ns, lookup_ns); \
+        result->_exit = CMDAPP_EXIT_STOP; \
+        return EXIT_SUCCESS; \
+    } while (0)
+    #define LOOKUP(entry_, search) do { \
+        const uint64_t lookup_start_ = _STAT_NOW(stats); \
+        (entry_) = (search); \
+        lookup_ns += _STAT_NOW(stats) - lookup_start_; \
+    } while (0)
+    #define FOUND(id, value_) do { \
+        const size_t id_ = (id); \
+        if (!_BITSET_TEST(result->_exists, id_)) { \
+            result->_touched[result->_touched_length++] = id_; \
+            _BITSET_SET(result->_exists, id_); \
+        } \
+        result->_values[id_] = (value_); \
+        if ((spec->_index._flags[id_] & CMDOPT_MULTI) \
+            && cmdapp_result_collect(result, id_, (value_)) \
+               != EXIT_SUCCESS) { \
+            FAIL(CMDAPP_ERR_NOMEM, -1, NULL, 0); \
+        } \
+        if (app) { \
+            const cmdopt_desc_t* desc_ = &spec->_start[id_]; \
+            cmdopt_t* option_ = desc_->result; \
+            option_->value = (value_); \
+            option_->flags |= CMDOPT_EXISTS; \
+            if (desc_->handler) { \
+                _STAT(stats, callbacks, 1); \
+                if (desc_->handler(desc_->handler_data, option_, (value_)) \
+                    == CMDAPP_STOP) { \
+                    HALT(); \
+                } \
+            } else if (app->_proc) { \
+                app->_proc(app->_user_data, option_, NULL); \
+                _STAT(stats, callbacks, 1); \
+            } \
+        } \
+    } while (0)
+    // In stream mode the procedure is the only consumer of arguments.
+    const bool stream = spec->_mode & CMDAPP_MODE_STREAM;
+    const bool glob = spec->_mode & CMDAPP_MODE_GLOB;
+    #define APPEND_ARG(arg) do { \
+        size_t matches_ = 0; \
+        if (glob && strpbrk((arg), "*?[") != NULL) { \
+            result->_globbed = true; \
+            if (cmdapp_expand_arg(result, app, (arg), stream, &matches_) \
+                != EXIT_SUCCESS) { \
+                FAIL(CMDAPP_ERR_NOMEM, i, NULL, 0); \
+            } \
+        } \
+        if (matches_ == 0) { \
+            if (app && app->_proc) { \
+                app->_proc(app->_user_data, NULL, arg); \
+                _STAT(stats, callbacks, 1); \
+            } \
+            if (!stream \
+                && cmdapp_result_append(result, arg) != EXIT_SUCCESS) { \
+                FAIL(CMDAPP_ERR_NOMEM, i, NULL, 0); \
+            } \
+        } \
+    } while (0)
+
+    cmdapp_cursor_t cursor;
+    cmdapp_cursor_init(&cursor, argc, argv,
+                       spec->_mode & CMDAPP_MODE_RESPONSE);
+    #define PEEK(token_) do { \
+        const cmdapp_errcode_t code_ \
+            = cmdapp_cursor_peek(&cursor, result, &(token_)); \
+        if (code_ != CMDAPP_OK) { \
+            FAIL(code_, cursor.index, (token_), strlen(token_)); \
+        } \
+    } while (0)
+
+    bool only_args = false;
+    bool named = false;
+    for (;;) {
+        const char* current;
+        PEEK(current);
+        if (current == NULL) {
+            break;
+        }
+        const cmdapp_token_t* token = cursor.token;
+        cmdapp_cursor_skip(&cursor);
+        const int i = cursor.index;
+        if (i > 0 && !named) {
+            // Whatever argv[0] gave is the program name, not an argument.
+            result->_args_from = result->_args.length;
+            named = true;
+        }
+        if (only_args) {
+            APPEND_ARG(current);
+            continue;
+        }
+        if (token->kind == CMDAPP_TOKEN_END) {
+            // Everything after `--` is taken literally, `@path` included.
+            only_args = true;
+            cursor.expand = false;
+            continue;
+        }
+        const char* next;
+        const cmdopt_flags_t* flags = spec->_index._flags;
+        uint32_t entry;
+        if (token->kind == CMDAPP_TOKEN_LONG) {
+            // The pre-scan found the `=` of longopt args, if any.
+            const char* name = current + 2;
+            const size_t length = token->span - 2;
+            const char* arg = current[token->span] == '='
+                              ? current + token->span + 1 : NULL;
+
+            LOOKUP(entry, cmdapp_search_long(spec, name, length, stats));
+            if (!entry) {
+                // Built-in --help and --version, unless the app has its own,
+                // which the lookup would have found.
+                bool help = length == 4 && strncmp(name, "help", 4) == 0;
+                bool version = length == 7
+                               && strncmp(name, "version", 7) == 0;
+                if (!help && !version && length
+                    && (spec->_mode & CMDAPP_MODE_ABBREV)) {
+                    size_t first, run, count;
+                    LOOKUP(count, cmdapp_search_prefix(spec, name, length,
+                                                       &first, &run));
+                    help = !spec->_custom_help && length < 4
+                           && strncmp(name, "help", length) == 0;
+                    version = !spec->_custom_ver && length < 7
+                              && strncmp(name, "version", length) == 0;
+                    if (count + help + version > 1) {
+                        result->_error.candidates = first;
+                        result->_error.candidate_count = run;
+                        result->_error.help_candidate = help;
+                        result->_error.version_candidate = version;
+                        REJECT(CMDAPP_ERR_AMBIGUOUS, i, current, length + 2);
+                    }
+                    if (count == 1) {
+                        entry = (uint32_t)(spec->_index._sorted[first]
+                                           - spec->_start) + 1;
+                    }
+                }
+                if (help || version) {
+                    // --help and --version win over errors collected so far.
+                    result->_error.code = CMDAPP_OK;
+                    result->_error_count = 0;
+                }
+                if (help) {
+                    result->_exit = CMDAPP_EXIT_HELP;
+                    if (app) cmdapp_print_help(app);
+                    return EXIT_SUCCESS;
+                } else if (version) {
+                    result->_exit = CMDAPP_EXIT_VERSION;
+                    if (app) cmdapp_print_version(app);
+                    return EXIT_SUCCESS;
+                } else if (!entry) {
+                    REJECT(CMDAPP_ERR_UNKNOWN, i, current, length + 2);
+                }
+            }
+            if (flags[entry - 1] & CMDOPT_TAKESARG) {
+                if (arg == NULL) {
+                    REJECT(CMDAPP_ERR_EXPECTS_ARG, i, current, length + 2);
+                }
+            } else if (!(flags[entry - 1] & CMDOPT_MAYTAKEARG)) {
+                if (arg != NULL) {
+                    REJECT(CMDAPP_ERR_NO_ARG, i, current, length + 2);
+                }
+            }
+            FOUND(entry - 1, arg);
+        } else if (token->kind == CMDAPP_TOKEN_SHORT) {
+            if (spec->_mode & CMDAPP_MODE_SHORTARG) {
+                LOOKUP(entry, cmdapp_search_short(spec, current[1], stats));
+                if (!entry) {
+                    REJECT(CMDAPP_ERR_UNKNOWN, i, current + 1, 1);
+                }
+                const char* value = NULL;
+                if (flags[entry - 1] & CMDOPT_TAKESARG) {
+                    if (current[2]) {
+                        value = current + 2;
+                    } else {
+                        PEEK(next);
+                        if (!_cmdapp_is_value(next, flags[entry - 1])) {
+                            REJECT(CMDAPP_ERR_EXPECTS_ARG, i, current + 1, 1);
+                        }
+                        value = next;
+                        cmdapp_cursor_skip(&cursor);
+                    }
+                } else if (flags[entry - 1] & CMDOPT_MAYTAKEARG) {
+                    value = current[2] ? current + 2 : NULL;
+                } else if (current[2] != 0) {
+                    REJECT(CMDAPP_ERR_NO_ARG, i, current + 1, 1);
+                }
+                FOUND(entry - 1, value);
+            } else /* app->_mode | CMDAPP_MODE_MULTIFLAG */ {
+                // `-abc` is `-a -b -c`, unless one of them takes an argument,
+                // in which case the rest of the bundle is that argument.
+                for (size_t j = 1; current[j]; j++) {
+                    LOOKUP(entry, cmdapp_search_short(spec, current[j],
+                                                      stats));
+                    if (!entry) {
+                        REJECT(CMDAPP_ERR_UNKNOWN, i, current + j, 1);
+                    }
+                    const char* rest = current + j + 1;
+                    if (flags[entry - 1] & CMDOPT_TAKESARG) {
+                        if (*rest) {
+                            FOUND(entry - 1, rest);
+                        } else {
+                            PEEK(next);
+                            if (!_cmdapp_is_value(next, flags[entry - 1])) {
+                                REJECT(CMDAPP_ERR_EXPECTS_ARG, i, current + j,
+                                     1);
+                            }
+                            FOUND(entry - 1, next);
+                            cmdapp_cursor_skip(&cursor);
+                        }
+                        break;
+                    } else if (flags[entry - 1] & CMDOPT_MAYTAKEARG) {
+                        FOUND(entry - 1, *rest ? rest : NULL);
+                        break;
+                    }
+                    FOUND(entry - 1, NULL);
+                }
+            }
+        } else {
+            APPEND_ARG(current);
+        }
+    }
+    if (!named) {
+        result->_args_from = result->_args.length;
+    }
+
+    // Options still unset fall back to their environment variables, matched
+    // against the bound names in a single pass over the environment. A
+    // variable yields to a conflicting option given on the command line.
+    if (spec->_index._env_mask) {
+        const cmdopt_flags_t* flags = spec->_index._flags;
+        const size_t from_argv = result->_touched_length;
+        #ifdef _POSIX_VERSION
+        for (char** env = environ; *env; env++) {
+            const char* value = strchr(*env, '=');
+            if (value == NULL || *++value == 0) continue;
+            uint32_t entry;
+            LOOKUP(entry, cmdapp_search_env(spec, *env,
+                                            (size_t)(value - 1 - *env),
+                                            stats));
+        #else
+        for (size_t id = 0; id < spec->_length; id++) {
+            if (spec->_start[id].env == NULL) continue;
+            const char* value = getenv(spec->_start[id].env);
+            if (value == NULL || *value == 0) continue;
+            const uint32_t entry = (uint32_t)id + 1;
+        #endif /* _POSIX_VERSION */
+            if (entry && !_BITSET_TEST(result->_exists, entry - 1)
+                && !cmdapp_conflicts_with_set(spec, result, entry - 1,
+                                              from_argv)) {
+                const bool takes_arg = flags[entry - 1]
+                                       & (CMDOPT_TAKESARG | CMDOPT_MAYTAKEARG);
+                FOUND(entry - 1, takes_arg ? value : NULL);
+            }
+        }
+    }
+    // Whatever is still unset then comes from the config file.
+    if (spec->_config_count) {
+        const cmdopt_flags_t* flags = spec->_index._flags;
+        const size_t from_above = result->_touched_length;
+        for (size_t k = 0; k < spec->_config_count; k++) {
+            const size_t id = spec->_config_ids[k];
+            if (id < spec->_length && !_BITSET_TEST(result->_exists, id)
+                && !cmdapp_conflicts_with_set(spec, result, id, from_above)) {
+                const char* value = spec->_config_values[id];
+                const bool takes_arg = flags[id]
+                                       & (CMDOPT_TAKESARG | CMDOPT_MAYTAKEARG);
+                FOUND(id, takes_arg && value != _cmdapp_config_set ? value
+                                                                   : NULL);
+            }
+        }
+    }
+
+    // Repeated options are grouped once every occurrence is known.
+    if (cmdapp_apply_groups(spec, result, app) != EXIT_SUCCESS) {
+        FAIL(CMDAPP_ERR_NOMEM, -1, NULL, 0);
+    }
+
+    // Typed options are converted once their final values are known, so a
+    // value overridden on the command line is never converted.
+    for (size_t k = 0; k < result->_touched_length; k++) {
+        const size_t id = result->_touched[k];
+        const cmdopt_flags_t type = spec->_index._flags[id] & CMDOPT_TYPE_MASK;
+        if (!type) continue;
+        const char* value = result->_values[id];
+        cmdopt_value_t typed = { 0 };
+        if (value == NULL) {
+            // A flag given without an argument
+            typed.b = type == CMDOPT_BOOL;
+        } else {
+            cmdapp_errcode_t code = cmdapp_convert(value, type, &typed);
+            if (code == CMDAPP_OK
+                && cmdapp_out_of_range(&spec->_start[id], typed)) {
+                code = CMDAPP_ERR_RANGE;
+            }
+            if (code != CMDAPP_OK) {
+                result->_error.option = id;
+                REJECT(code, -1, value, strlen(value));
+            }
+        }
+        result->_typed[id] = typed;
+        if (app) {
+            spec->_start[id].result->typed = typed;
+        }
+    }
+
+    #undef PEEK
+    #undef LOOKUP
+    #undef APPEND_ARG
+    #undef FOUND
+    #undef HALT
+    #undef REJECT
+    #undef FAIL
+    #undef STOP
+
+    const uint64_t resolve_start = _STAT_NOW(stats);
+    _STAT(stats, tokenize_ns, resolve_start - parse_start - lookup_ns);
+    _STAT(stats, lookup_ns, lookup_ns);
+    const int status = cmdapp_resolve_options(spec, result);
+    _STAT(stats, resolve_ns, _STAT_NOW(stats) - resolve_start);
+    if (status != EXIT_SUCCESS) {
+        if (result->_error_count) result->_error = result->_errors[0];
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+int cmdapp_parse(const cmdapp_spec_t* spec, int argc, char* const* argv,
+                 cmdapp_result_t* result) {
+    if (cmdapp_result_reserve(result) != EXIT_SUCCESS) {
+        result->_error.code = CMDAPP_ERR_NOMEM;
+        result->_error.index = -1;
+        return EXIT_FAILURE;
+    }
+    return cmdapp_parse_argv(spec, argc, argv, result, NULL);
+}
+
+// Checks the values of options with checks and, if the app has checks for
+// them, the arguments of a successful parse, all in one batch. Each path that
+// fails becomes an error as if the parse had found it.
+static int cmdapp_check_values(const cmdapp_spec_t* spec,
+                               cmdapp_result_t* result, cmdapp_check_t args) {
+    const cmdopt_desc_t* options = spec->_start;
+    const size_t from = result->_args_from;
+    size_t n = args && result->_args.length > from
+               ? result->_args.length - from : 0;
+    for (size_t k = 0; k < result->_touched_length; k++) {
+        const size_t id = result->_touched[k];
+        if (options[id].check && result->_values[id] != NULL) {
+            n += result->_multi_count[id] ? result->_multi_count[id] : 1;
+        }
+    }
+    if (n == 0) {
+        return EXIT_SUCCESS;
+    }
+    // The paths, their checks, their errors and the options they belong to
+    const char** paths = malloc(n * (sizeof(char*) + sizeof(size_t)
+                                     + sizeof(int) + sizeof(cmdapp_check_t)));
+    if (paths == NULL) {
+        result->_error.code = CMDAPP_ERR_NOMEM;
+        result->_error.index = -1;
+        result->_error_count = 0;
+        return EXIT_FAILURE;
+    }
+    size_t* ids = (size_t*)(paths + n);
+    int* errors = (int*)(ids + n);
+    cmdapp_check_t* checks = (cmdapp_check_t*)(errors + n);
+    size_t count = 0;
+    for (size_t k = 0; k < result->_touched_length; k++) {
+        const size_t id = result->_touched[k];
+        if (!options[id].check || result->_values[id] == NULL) continue;
+        const size_t multi = result->_multi_count[id];
+        for (size_t j = 0; j < (multi ? multi : 1); j++) {
+            paths[count] = multi
+                           ? result->_multi[result->_multi_start[id] + j]
+                           : result->_values[id];
+            ids[count] = id;
+            checks[count++] = options[id].check;
+        }
+    }
+    for (size_t j = from; count < n; j++) {
+        paths[count] = result->_args.contents[j];
+        ids[count] = SIZE_MAX;
+        checks[count++] = args;
+    }
+
+    int status = EXIT_SUCCESS;
+    if (cmdapp_check_paths(n, paths, checks, errors, 0)) {
+        status = EXIT_FAILURE;
+        for (size_t i = 0; i < n; i++) {
+            if (errors[i] == 0) continue;
+            result->_error.option = ids[i];
+            result->_error.path_errno = errors[i];
+            if (!cmdapp_result_reject(result, CMDAPP_ERR_PATH, -1, paths[i],
+                                      strlen(paths[i]))) {
+                break;
+            }
+        }
+        if (result->_error_count) result->_error = result->_errors[0];
+    }
+    free(paths);
+    return status;
+}
+
+// Returns the index plus one of the subcommand called `name`, or zero,
+// building the name table first if needed.
+static size_t cmdapp_search_subcommand(cmdapp_t* app, const char* name) {
+    if (app->_subcommand_slots == NULL) {
+        size_t slots = 8;
+        while (slots < app->_subcommands_length * 2) slots *= 2;
+        app->_subcommand_slots = cmdapp_alloc(app, slots * sizeof(uint32_t));
+        if (app->_subcommand_slots == NULL) {
+            app->_oom = true;
+            return 0;
+        }
+        memset(app->_subcommand_slots, 0, slots * sizeof(uint32_t));
+        app->_subcommand_mask = slots - 1;
+        for (size_t i = 0; i < app->_subcommands_length; i++) {
+            const char* key = app->_subcommands[i].name;
+            size_t slot = _cmdapp_hash(key, strlen(key))
+                          & app->_subcommand_mask;
+            uint32_t entry;
+            while ((entry = app->_subcommand_slots[slot])
+                   && strcmp(app->_subcommands[entry - 1].name, key) != 0) {
+                slot = (slot + 1) & app->_subcommand_mask;
+            }
+            if (entry == 0) {
+                app->_subcommand_slots[slot] = (uint32_t)i + 1;
+            }
+        }
+    }
+    size_t slot = _cmdapp_hash(name, strlen(name)) & app->_subcommand_mask;
+    for (uint32_t entry; (entry = app->_subcommand_slots[slot]); ) {
+        if (strcmp(app->_subcommands[entry - 1].name, name) == 0) {
+            return entry;
+        }
+        slot = (slot + 1) & app->_subcommand_mask;
+    }
+    return 0;
+}
+
+// Makes `selected` the app's subcommand, unregistering the options of the
+// previous one and registering its own.
+static void cmdapp_select_subcommand(cmdapp_t* app, size_t selected) {
+    cmdapp_spec_t* spec = &app->_spec;
+    if (app->_selected) {
+        // Clear the last run's options while their descriptors still exist.
+        cmdapp_result_reset(&app->_result);
+        for (size_t i = app->_base_length; i < spec->_length; i++) {
+            cmdapp_free(app, (void*)spec->_start[i].conflicts);
+        }
+        spec->_length = app->_base_length;
+        spec->_index._built = false;
+    } else {
+        app->_base_length = spec->_length;
+    }
+    // The options listed by --help change with the selection.
+    app->_help_stale = true;
+    app->_selected = selected;
+    if (selected) {
+        const cmdapp_subcommand_t* subcommand
+            = &app->_subcommands[selected - 1];
+        subcommand->setup(app, subcommand->user_data);
+    }
+}
+
+// A serialised result: this header, then the sections below, each starting at a
+// multiple of eight bytes. Strings are referred to by their offset in the
+// string blob plus one, or zero for none.
+//
+//     uint64_t exists[words]        the options provided, as a bitset
+//     cmdopt_value_t typed[options] their converted values
+//     uint32_t values[options]      their values
+//     uint32_t starts[options]      where the values of each option start
+//     uint32_t counts[options]      and how many it has
+//     uint32_t multi[multi]         the values of CMDOPT_MULTI options
+//     uint32_t args[args]           the standalone arguments
+//     char strings[strings]         every string, NUL-terminated
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t options;
+    uint32_t args;
+    uint32_t multi;
+    // Identifies the options of the spec it was parsed against
+    uint32_t fingerprint;
+    uint64_t strings;
+    // How many of the arguments came from argv[0]
+    uint64_t args_from;
+} cmdapp_packed_t;
+
+// "CMDR" in memory order on little-endian machines
+#define _CMDAPP_PACKED_MAGIC   0x52444d43u
+#define _CMDAPP_PACKED_VERSION 3
+
+#define _ALIGN8(n) (((n) + 7) & ~(size_t)7)
+
+// Hashes the flags and names of a spec's options, so that results are only
+// read back against the options they were parsed with.
+static uint32_t cmdapp_fingerprint(const cmdapp_spec_t* spec) {
+    uint32_t hash = 2166136261u;
+    for (size_t id = 0; id < spec->_length; id++) {
+        const cmdopt_desc_t* desc = &spec->_start[id];
+        const char key[] = {
+            desc->shorto, (char)(desc->flags & 0xff), (char)(desc->flags >> 8)
+        };
+        hash = _cmdapp_hash_from(hash, key, sizeof(key));
+        if (desc->longo) {
+            hash = _cmdapp_hash_from(hash, desc->longo,
+                                     strlen(desc->longo) + 1);
+        }
+    }
+    return hash;
+}
+
+// Where each section of a serialised result starts, and its total size.
+typedef struct {
+    size_t exists;
+    size_t typed;
+    size_t values;
+    size_t starts;
+    size_t counts;
+    size_t multi;
+    size_t args;
+    size_t strings;
+    size_t size;
+} cmdapp_sections_t;
+
+static cmdapp_sections_t cmdapp_packed_sections(size_t options, size_t args,
+                                                size_t multi,
+                                                size_t strings) {
+    cmdapp_sections_t at;
+    at.exists = sizeof(cmdapp_packed_t);
+    at.typed = at.exists + _BITSET_WORDS(options) * sizeof(uint64_t);
+    at.values = at.typed + options * sizeof(cmdopt_value_t);
+    at.starts = at.values + options * sizeof(uint32_t);
+    at.counts = at.starts + options * sizeof(uint32_t);
+    at.multi = at.counts + options * sizeof(uint32_t);
+    at.args = at.multi + multi * sizeof(uint32_t);
+    at.strings = _ALIGN8(at.args + args * sizeof(uint32_t));
+    at.size = _ALIGN8(at.strings + strings);
+    return at;
+}
+
+size_t cmdapp_serialize(const cmdapp_result_t* result, void* buffer,
+                        size_t size) {
+    const size_t options = result->_spec->_length;
+    const size_t args = result->_args.length;
+    size_t multi = 0;
+    size_t strings = 0;
+    for (size_t k = 0; k < result->_touched_length; k++) {
+        const size_t id = result->_touched[k];
+        const size_t count = result->_multi_count[id];
+        const char* const* values = result->_multi + result->_multi_start[id];
+        // An option's value is the last of its values, if it has several.
+        for (size_t j = 0; j < count; j++) {
+            strings += strlen(values[j]) + 1;
+        }
+        if (count == 0 && result->_values[id] != NULL) {
+            strings += strlen(result->_values[id]) + 1;
+        }
+        multi += count;
+    }
+    for (size_t i = 0; i < args; i++) {
+        strings += strlen(result->_args.contents[i]) + 1;
+    }
+    if (options > UINT32_MAX || args > UINT32_MAX || multi > UINT32_MAX
+        || strings >= UINT32_MAX) {
+        return 0;
+    }
+    const cmdapp_sections_t at = cmdapp_packed_sections(options, args, multi,
+                                                        strings);
+    if (buffer == NULL || size < at.size) {
+        return at.size;
+    }
+
+    char* base = buffer;
+    memset(base, 0, at.size);
+    const cmdapp_packed_t header = {
+        _CMDAPP_PACKED_MAGIC, _CMDAPP_PACKED_VERSION, (uint32_t)options,
+        (uint32_t)args, (uint32_t)multi, cmdapp_fingerprint(result->_spec),
+        strings, result->_args_from
+    };
+    memcpy(base, &header, sizeof(header));
+    if (options) {
+        memcpy(base + at.exists, result->_exists,
+               _BITSET_WORDS(options) * sizeof(uint64_t));
+    }
+    cmdopt_value_t* typed = (cmdopt_value_t*)(base + at.typed);
+    uint32_t* values = (uint32_t*)(base + at.values);
+    uint32_t* starts = (uint32_t*)(base + at.starts);
+    uint32_t* counts = (uint32_t*)(base + at.counts);
+    uint32_t* multi_values = (uint32_t*)(base + at.multi);
+    uint32_t* arg_values = (uint32_t*)(base + at.args);
+    char* blob = base + at.strings;
+    size_t offset = 0;
+    #define PUT(str, slot) do { \
+        const size_t length_ = strlen(str) + 1; \
+        memcpy(blob + offset, (str), length_); \
+        (slot) = (uint32_t)offset + 1; \
+        offset += length_; \
+    } while (0)
+    size_t next = 0;
+    for (size_t k = 0; k < result->_touched_length; k++) {
+        const size_t id = result->_touched[k];
+        const size_t count = result->_multi_count[id];
+        const char* const* group = result->_multi + result->_multi_start[id];
+        typed[id] = result->_typed[id];
+        starts[id] = (uint32_t)next;
+        counts[id] = (uint32_t)count;
+        for (size_t j = 0; j < count; j++) {
+            PUT(group[j], multi_values[next]);
+            next++;
+        }
+        if (count) {
+            values[id] = multi_values[next - 1];
+        } else if (result->_values[id] != NULL) {
+            PUT(result->_values[id], values[id]);
+        }
+    }
+    for (size_t i = 0; i < args; i++) {
+        PUT(result->_args.contents[i], arg_values[i]);
+    }
+    #undef PUT
+    return at.size;
+}
+
+// Fills a result from a serialised one at `data`, pointing it into the
+// serialised strings. Fails, leaving the result reset, if `data` is not a
+// result for the result's spec, is misaligned, or memory runs out.
+static int cmdapp_result_unpack(cmdapp_result_t* result, const void* data,
+                                size_t size) {
+    cmdapp_result_reset(result);
+    const size_t options = result->_spec->_length;
+    cmdapp_packed_t header;
+    if (size < sizeof(header) || (uintptr_t)data % 8 != 0) {
+        return EXIT_FAILURE;
+    }
+    memcpy(&header, data, sizeof(header));
+    if (header.magic != _CMDAPP_PACKED_MAGIC
+        || header.version != _CMDAPP_PACKED_VERSION
+        || header.options != options || header.strings > size
+        || header.args_from > header.args
+        || header.fingerprint != cmdapp_fingerprint(result->_spec)) {
+        return EXIT_FAILURE;
+    }
+    const cmdapp_sections_t at = cmdapp_packed_sections(
+        options, header.args, header.multi, (size_t)header.strings);
+    const char* base = data;
+    const char* blob = base + at.strings;
+    if (at.size > size
+        || (header.strings && blob[header.strings - 1] != 0)) {
+        return EXIT_FAILURE;
+    }
+    const uint64_t* exists = (const uint64_t*)(base + at.exists);
+    const cmdopt_value_t* typed = (const cmdopt_value_t*)(base + at.typed);
+    const uint32_t* values = (const uint32_t*)(base + at.values);
+    const uint32_t* starts = (const uint32_t*)(base + at.starts);
+    const uint32_t* counts = (const uint32_t*)(base + at.counts);
+    const uint32_t* multi = (const uint32_t*)(base + at.multi);
+    const uint32_t* args = (const uint32_t*)(base + at.args);
+    // Offsets past the blob are rejected, and the blob ends in a terminator.
+    #define TEXT(slot) ((slot) ? blob + (slot) - 1 : NULL)
+    #define VALID(slot) ((slot) <= header.strings)
+
+    if (header.multi > result->_multi_capacity) {
+        const char** grown
+            = cmdapp_result_grow(result, result->_multi,
+                                 sizeof(char*) * result->_multi_capacity,
+                                 sizeof(char*) * header.multi);
+        if (grown == NULL) {
+            return EXIT_FAILURE;
+        }
+        result->_multi = grown;
+        result->_multi_capacity = header.multi;
+    }
+    for (size_t i = 0; i < header.multi; i++) {
+        if (multi[i] == 0 || !VALID(multi[i])) {
+            return EXIT_FAILURE;
+        }
+        result->_multi[i] = TEXT(multi[i]);
+    }
+    for (size_t w = 0; w < _BITSET_WORDS(options); w++) {
+        for (uint64_t bits = exists[w]; bits; bits &= bits - 1) {
+            const size_t id = w * 64 + __builtin_ctzll(bits);
+            if (id >= options || !VALID(values[id])
+                || (uint64_t)starts[id] + counts[id] > header.multi) {
+                cmdapp_result_reset(result);
+                return EXIT_FAILURE;
+            }
+            _BITSET_SET(result->_exists, id);
+            result->_touched[result->_touched_length++] = id;
+            result->_values[id] = TEXT(values[id]);
+            result->_typed[id] = typed[id];
+            result->_multi_start[id] = starts[id];
+            result->_multi_count[id] = counts[id];
+        }
+    }
+    for (size_t i = 0; i < header.args; i++) {
+        if (args[i] == 0 || !VALID(args[i])
+            || cmdapp_result_append(result, TEXT(args[i])) != EXIT_SUCCESS) {
+            cmdapp_result_reset(result);
+            return EXIT_FAILURE;
+        }
+    }
+    result->_args_from = (size_t)header.args_from;
+    #undef TEXT
+    #undef VALID
+    return EXIT_SUCCESS;
+}
+
+// Sets the user-side options of an app from its result.
+static void cmdapp_publish(const cmdapp_spec_t* spec,
+                           const cmdapp_result_t* result) {
+    for (size_t k = 0; k < result->_touched_length; k++) {
+        const size_t id = result->_touched[k];
+        cmdopt_t* option = spec->_start[id].result;
+        option->flags |= CMDOPT_EXISTS;
+        option->value = result->_values[id];
+        option->typed = result->_typed[id];
+        if (result->_multi_count[id]) {
+            option->values = result->_multi + result->_multi_start[id];
+            option->count = result->_multi_count[id];
+        }
+    }
+}
+
+int cmdapp_deserialize(cmdapp_result_t* result, const void* data,
+                       size_t size) {
+    if (cmdapp_result_reserve(result) != EXIT_SUCCESS
+        || cmdapp_result_unpack(result, data, size) != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+    if (result->_owner != NULL) {
+        cmdapp_publish(result->_spec, result);
+    }
+    return EXIT_SUCCESS;
+}
+
+cmdapp_result_t* cmdapp_get_result(cmdapp_t* app) {
+    return &app->_result;
+}
+
+void cmdapp_enable_cache(cmdapp_t* app, const char* dir) {
+    app->_cache_dir = dir;
+}
+
+// Where a run's result is looked up in the cache and stored: a key made of
+// everything the result depends on but files, and the path of its entry.
+typedef struct {
+    cmdapp_text_t key;
+    char* path;
+    char buffer[1024];
+} cmdapp_lookup_t;
+
+static void cmdapp_lookup_release(cmdapp_lookup_t* lookup) {
+    if (lookup->key.data != lookup->buffer) {
+        free(lookup->key.data);
+    }
+    free(lookup->path);
+    lookup->path = NULL;
+}
+
+#ifdef _POSIX_VERSION
+
+// A cache entry: this header, the key, the response files read and the
+// serialised result, each starting at a multiple of eight bytes.
+typedef struct {
+    uint32_t magic;
+    uint32_t files;
+    uint64_t key_length;
+    uint64_t files_length;
+    uint64_t result_length;
+} cmdapp_entry_t;
+
+// "CMDC" in memory order on little-endian machines
+#define _CMDAPP_ENTRY_MAGIC 0x43444d43u
+
+// A response file read by a cached run, followed by its path and its
+// terminator, padded to eight bytes.
+typedef struct {
+    int64_t mtime;
+    uint64_t size;
+    uint64_t path_length;
+} cmdapp_dependency_t;
+
+// Writes the key of a run, or returns false if the run cannot be cached.
+// Two runs with equal keys reading unchanged files have equal results.
+static bool cmdapp_cache_key(const cmdapp_t* app, int argc, char** argv,
+                             cmdapp_text_t* key) {
+    const cmdapp_spec_t* spec = &app->_spec;
+    #define PUT(value) cmdapp_text_put(key, (const char*)&(value), \
+                                       sizeof(value))
+    // Strings are preceded by whether they exist at all.
+    #define PUTS(str) do { \
+        const char* str_ = (str); \
+        const bool exists_ = str_ != NULL; \
+        PUT(exists_); \
+        if (str_) cmdapp_text_put(key, str_, strlen(str_) + 1); \
+    } while (0)
+    const uint32_t version = _CMDAPP_PACKED_VERSION;
+    PUT(version);
+    PUT(spec->_mode);
+    PUT(app->_arg_check);
+    PUT(spec->_length);
+    for (size_t id = 0; id < spec->_length; id++) {
+        const cmdopt_desc_t* desc = &spec->_start[id];
+        if (desc->handler != NULL) {
+            return false;
+        }
+        PUT(desc->shorto);
+        PUT(desc->flags);
+        PUT(desc->check);
+        PUT(desc->ranged);
+        if (desc->ranged) {
+            PUT(desc->min.u);
+            PUT(desc->max.u);
+        }
+        PUTS(desc->longo);
+        for (cmdopt_t* const* other = desc->conflicts; other && *other;
+             other++) {
+            PUT((*other)->_id);
+        }
+        const size_t end = SIZE_MAX;
+        PUT(end);
+        PUTS(desc->env);
+        if (desc->env != NULL) {
+            PUTS(getenv(desc->env));
+        }
+    }
+    PUT(spec->_config_count);
+    for (size_t k = 0; k < spec->_config_count; k++) {
+        PUT(spec->_config_ids[k]);
+        PUTS(spec->_config_values[spec->_config_ids[k]]);
+    }
+    char cwd[4096];
+    if (getcwd(cwd, sizeof(cwd)) == NULL) {
+        return false;
+    }
+    PUTS(cwd);
+    PUT(argc);
+    for (int i = 0; i < argc; i++) {
+        PUTS(argv[i]);
+    }
+    #undef PUTS
+    #undef PUT
+    return true;
+}
+
+// Builds the run's key and entry path, and takes its result from the cache
+// if the entry there is for the same key and the files it read have not
+// changed since. The entry then stays mapped until the next run.
+static bool cmdapp_cache_find(cmdapp_t* app, int argc, char** argv,
+                              cmdapp_lookup_t* lookup) {
+    if (app->_proc != NULL) {
+        return false;
+    }
+    lookup->key = (cmdapp_text_t){ lookup->buffer, 0,
+                                   sizeof(lookup->buffer) };
+    if (!cmdapp_cache_key(app, argc, argv, &lookup->key)) {
+        return false;
+    }
+    if (lookup->key.length > lookup->key.capacity) {
+        // Measured; write it again into a buffer that fits.
+        const size_t length = lookup->key.length;
+        lookup->key = (cmdapp_text_t){ malloc(length), 0, length };
+        if (lookup->key.data == NULL
+            || !cmdapp_cache_key(app, argc, argv, &lookup->key)
+            || lookup->key.length != length) {
+            return false;
+        }
+    }
+    uint64_t hash = 14695981039346656037u;
+    for (size_t i = 0; i < lookup->key.length; i++) {
+        hash ^= (unsigned char)lookup->key.data[i];
+        hash *= 1099511628211u;
+    }
+    lookup->path = malloc(strlen(app->_cache_dir) + 18);
+    if (lookup->path == NULL) {
+        return false;
+    }
+    sprintf(lookup->path, "%s/%016llx", app->_cache_dir,
+            (unsigned long long)hash);
+
+    cmdapp_file_t file;
+    if (cmdapp_map_file(lookup->path, &file) != CMDAPP_OK) {
+        return false;
+    }
+    const char* base = file._base;
+    cmdapp_entry_t entry = { 0 };
+    bool valid = file._size >= sizeof(entry);
+    if (valid) {
+        memcpy(&entry, base, sizeof(entry));
+        valid = entry.magic == _CMDAPP_ENTRY_MAGIC
+                && entry.key_length == lookup->key.length
+                && entry.files_length <= file._size
+                && entry.result_length <= file._size
+                && sizeof(entry) + _ALIGN8(entry.key_length)
+                   + entry.files_length + entry.result_length <= file._size
+                && memcmp(base + sizeof(entry), lookup->key.data,
+                          lookup->key.length) == 0;
+    }
+    const char* read = base + sizeof(entry) + _ALIGN8(lookup->key.length);
+    const char* end = read + (valid ? entry.files_length : 0);
+    for (uint32_t k = 0; valid && k < entry.files; k++) {
+        cmdapp_dependency_t dependency;
+        struct stat info;
+        valid = (size_t)(end - read) >= sizeof(dependency);
+        if (!valid) break;
+        memcpy(&dependency, read, sizeof(dependency));
+        read += sizeof(dependency);
+        valid = dependency.path_length <= (size_t)(end - read)
+                && dependency.path_length > 0
+                && read[dependency.path_length - 1] == 0
+                && stat(read, &info) == 0
+                && (uint64_t)info.st_size == dependency.size
+                && _cmdapp_mtime(&info) == dependency.mtime;
+        read += valid ? _ALIGN8(dependency.path_length) : 0;
+    }
+    if (valid) {
+        valid = cmdapp_result_unpack(&app->_result, end, entry.result_length)
+                == EXIT_SUCCESS;
+    }
+    if (!valid) {
+        cmdapp_unmap_file(&file);
+        return false;
+    }
+    app->_cache = file;
+    return true;
+}
+
+// Writes the result of a successful run to its cache entry, replacing any
+// entry there at once by renaming a complete file over it.
+static void cmdapp_cache_store(cmdapp_t* app, const cmdapp_lookup_t* lookup) {
+    if (lookup->path == NULL) {
+        return;
+    }
+    const cmdapp_result_t* result = &app->_result;
+    size_t files_length = 0;
+    for (size_t k = 0; k < result->_files_length; k++) {
+        files_length += sizeof(cmdapp_dependency_t)
+                        + _ALIGN8(strlen(result->_files[k]._path) + 1);
+    }
+    const size_t packed = cmdapp_serialize(result, NULL, 0);
+    if (packed == 0) {
+        return;
+    }
+    const size_t key_end = sizeof(cmdapp_entry_t)
+                           + _ALIGN8(lookup->key.length);
+    const size_t size = key_end + files_length + packed;
+    char* buffer = calloc(1, size);
+    char* temporary = malloc(strlen(lookup->path) + 8);
+    if (buffer == NULL || temporary == NULL) {
+        free(buffer);
+        free(temporary);
+        return;
+    }
+    const cmdapp_entry_t entry = {
+        _CMDAPP_ENTRY_MAGIC, (uint32_t)result->_files_length,
+        lookup->key.length, files_length, packed
+    };
+    memcpy(buffer, &entry, sizeof(entry));
+    memcpy(buffer + sizeof(entry), lookup->key.data, lookup->key.length);
+    char* write_at = buffer + key_end;
+    for (size_t k = 0; k < result->_files_length; k++) {
+        const cmdapp_file_t* file = &result->_files[k];
+        const size_t path_length = strlen(file->_path) + 1;
+        const cmdapp_dependency_t dependency = {
+            file->_mtime, file->_size, path_length
+        };
+        memcpy(write_at, &dependency, sizeof(dependency));
+        memcpy(write_at + sizeof(dependency), file->_path, path_length);
+        write_at += sizeof(dependency) + _ALIGN8(path_length);
+    }
+    cmdapp_serialize(result, write_at, packed);
+
+    sprintf(temporary, "%s.XXXXXX", lookup->path);
+    const int fd = mkstemp(temporary);
+    if (fd >= 0) {
+        const char* data = buffer;
+        size_t remaining = size;
+        while (remaining) {
+            const ssize_t written = write(fd, data, remaining);
+            if (written < 0) {
+                if (errno == EINTR) continue;
+                break;
+            }
+            data += written;
+            remaining -= (size_t)written;
+        }
+        if (close(fd) != 0 || remaining != 0
+            || rename(temporary, lookup->path) != 0) {
+            unlink(temporary);
+        }
+    }
+    free(buffer);
+    free(temporary);
+}
+
+#else
+
+static bool cmdapp_cache_find(cmdapp_t* app, int argc, char** argv,
+                              cmdapp_lookup_t* lookup) {
+    (void)app;
+    (void)argc;
+    (void)argv;
+    (void)lookup;
+    return false;
+}
+
+static void cmdapp_cache_store(cmdapp_t* app, const cmdapp_lookup_t* lookup) {
+    (void)app;
+    (void)lookup;
+}
+
+#endif /* _POSIX_VERSION */
+
+int cmdapp_run_argv(cmdapp_t* app, int argc, char** argv) {
+    app->_argc = argc;
+    app->_argv = argv;
+    // The subcommand takes the place of argv[0] for the rest of the parse.
+    int offset = 0;
+    if (app->_subcommands_length) {
+        const size_t selected
+            = argc > 1 ? cmdapp_search_subcommand(app, argv[1]) : 0;
+        if (selected != app->_selected) {
+            cmdapp_select_subcommand(app, selected);
+        }
+        offset = selected ? 1 : 0;
+    }
+    const cmdapp_spec_t* spec = cmdapp_get_spec(app);
+    cmdapp_result_t* result = &app->_result;
+    if (spec == NULL || cmdapp_result_reserve(result) != EXIT_SUCCESS) {
+        result->_error.code = CMDAPP_ERR_NOMEM;
+        result->_error.index = -1;
+        result->_error_count = 0;
+        if (app->_spec._mode & CMDAPP_MODE_PRINT) {
+            cmdapp_print_errors(app);
+        }
+        return EXIT_FAILURE;
+    }
+    // The last run's cache entry goes, and this run's is looked up.
+    cmdapp_unmap_file(&app->_cache);
+    cmdapp_lookup_t lookup;
+    lookup.key.data = lookup.buffer;
+    lookup.path = NULL;
+    if (app->_cache_dir != NULL
+        && cmdapp_cache_find(app, argc, argv, &lookup)) {
+        cmdapp_publish(spec, result);
+        cmdapp_lookup_release(&lookup);
+        return EXIT_SUCCESS;
+    }
+
+    int status = cmdapp_parse_argv(spec, argc - offset, argv + offset, result,
+                                   app);
+    if (status != EXIT_SUCCESS) {
+        if (result->_error.index >= 0) {
+            result->_error.index += offset;
+        }
+        for (size_t k = 0; k < result->_error_count; k++) {
+            if (result->_errors[k].index >= 0) {
+                result->_errors[k].index += offset;
+            }
+        }
+    } else if (!result->_exit) {
+        status = cmdapp_check_values(spec, result, app->_arg_check);
+        // What a pattern matches can change between identical runs.
+        if (status == EXIT_SUCCESS && !result->_globbed) {
+            cmdapp_cache_store(app, &lookup);
+        }
+    }
+    cmdapp_lookup_release(&lookup);
+    if (status != EXIT_SUCCESS && (spec->_mode & CMDAPP_MODE_PRINT)) {
+        cmdapp_print_errors(app);
+    }
+    return status;
+}
+
+// Adds `dashes` and `name` to the completions if the word being completed is
+// a prefix of them, with a `=` after options that need an argument.
+static void cmdapp_offer(cmdapp_text_t* out, const char* word, size_t length,
+                         const char* dashes, const char* name,
+                         bool takes_arg) {
+    const size_t dash_length = strlen(dashes);
+    const size_t name_length = strlen(name);
+    if (length > dash_length + name_length
+        || strncmp(word, dashes, length < dash_length ? length : dash_length)
+        || (length > dash_length
+            && strncmp(word + dash_length, name, length - dash_length))) {
+        return;
+    }
+    cmdapp_text_put(out, dashes, dash_length);
+    cmdapp_text_put(out, name, name_length);
+    cmdapp_text_puts(out, takes_arg ? "=\n" : "\n");
+}
+
+// Returns whether `arg` is an option that takes the next argument as its
+// own, which is for the shell to complete.
+static bool cmdapp_takes_next(const cmdapp_spec_t* spec, const char* arg) {
+    if (arg[0] != '-' || arg[1] == 0) {
+        return false;
+    }
+    size_t id;
+    if (arg[1] != '-') {
+        const uint32_t entry = spec->_index._short[(unsigned char)arg[1]];
+        if (arg[2] != 0 || entry == 0) return false;
+        id = entry - 1;
+    } else if (arg[2] == 0 || strchr(arg, '=') != NULL
+               || cmdapp_find_long(spec, arg + 2, strlen(arg + 2), &id)
+                  != CMDAPP_OK) {
+        return false;
+    }
+    return spec->_index._flags[id] & CMDOPT_TAKESARG;
+}
+
+// Writes the completions of argv[cursor] into `out`. Returns EXIT_FAILURE
+// if out of memory.
+static int cmdapp_completions(cmdapp_t* app, int argc, char** argv,
+                              int cursor, cmdapp_text_t* out) {
+    const char* word = cursor < argc ? argv[cursor] : "";
+    const size_t length = strlen(word);
+    int first = 1;
+    if (app->_subcommands_length) {
+        if (cursor == 1) {
+            // Subcommands are known by name alone, so none is set up.
+            for (size_t i = 0; i < app->_subcommands_length; i++) {
+                const char* name = app->_subcommands[i].name;
+                if (strncmp(name, word, length) == 0) {
+                    cmdapp_text_puts(out, name);
+                    cmdapp_text_puts(out, "\n");
+                }
+            }
+            if (word[0] != '-') return EXIT_SUCCESS;
+        }
+        // Only the subcommand in use registers its options.
+        const size_t selected
+            = argc > 1 && cursor > 1 ? cmdapp_search_subcommand(app, argv[1])
+                                     : 0;
+        if (selected != app->_selected) {
+            cmdapp_select_subcommand(app, selected);
+        }
+        first = selected ? 2 : 1;
+    }
+    const cmdapp_spec_t* spec = cmdapp_get_spec(app);
+    if (spec == NULL) {
+        return EXIT_FAILURE;
+    }
+    for (int i = first; i < cursor && i < argc; i++) {
+        if (strcmp(argv[i], "--") == 0) return EXIT_SUCCESS;
+    }
+    if ((cursor > first && cursor <= argc
+         && cmdapp_takes_next(spec, argv[cursor - 1]))
+        || word[0] != '-' || (word[1] != '-' && word[1] != 0)) {
+        // Arguments, and bundles of short options, are left to the shell.
+        return EXIT_SUCCESS;
+    }
+
+    if (word[1] == 0) {
+        for (size_t id = 0; id < spec->_length; id++) {
+            const char name[] = { spec->_start[id].shorto, 0 };
+            if (name[0]) cmdapp_offer(out, word, length, "-", name, false);
+        }
+    }
+    const bool abbrev = spec->_mode & CMDAPP_MODE_ABBREV;
+    size_t start = 0;
+    size_t run = abbrev ? spec->_index._sorted_length : spec->_length;
+    if (abbrev && length > 2) {
+        // The sorted names give the run of matches directly.
+        cmdapp_search_prefix(spec, word + 2, length - 2, &start, &run);
+    }
+    for (size_t k = start; k < start + run; k++) {
+        const cmdopt_desc_t* desc = abbrev ? spec->_index._sorted[k]
+                                           : &spec->_start[k];
+        if (desc->longo != NULL) {
+            const size_t id = (size_t)(desc - spec->_start);
+            cmdapp_offer(out, word, length, "--", desc->longo,
+                         spec->_index._flags[id] & CMDOPT_TAKESARG);
+        }
+    }
+    if (!spec->_custom_help) {
+        cmdapp_offer(out, word, length, "--", "help", false);
+    }
+    if (!spec->_custom_ver) {
+        cmdapp_offer(out, word, length, "--", "version", false);
+    }
+    return EXIT_SUCCESS;
+}
+
+int cmdapp_complete(cmdapp_t* app, int argc, char** argv, int cursor) {
+    char buffer[4096];
+    cmdapp_text_t out = { buffer, 0, sizeof(buffer) };
+    int status = cmdapp_completions(app, argc, argv, cursor, &out);
+    if (status == EXIT_SUCCESS && out.length > out.capacity) {
+        // Measured; write them again into a buffer that fits.
+        const size_t length = out.length;
+        out = (cmdapp_text_t){ malloc(length), 0, length };
+        status = out.data != NULL
+                 ? cmdapp_completions(app, argc, argv, cursor, &out)
+                 : EXIT_FAILURE;
+    }
+    if (status == EXIT_SUCCESS) {
+        cmdapp_write_stdout(out.data, out.length);
+    }
+    if (out.data != buffer) {
+        free(out.data);
+    }
+    return status;
+}
+
+// Scripts that hook a program into a shell's completion. In each, \1 stands
+// for the program's name and \2 for the name made into an identifier.
+static const struct {
+    const char* shell;
+    const char* script;
+} _completion_scripts[] = {
+    { "bash",
+      "_\2_complete() {\n"
+      "    local IFS=$'\\n'\n"
+      "    COMPREPLY=($(CMDAPP_COMPLETE=$COMP_CWORD \"${COMP_WORDS[@]}\" "
+      "2>/dev/null))\n"
+      "    [[ ${COMPREPLY[0]} == *= ]] && compopt -o nospace\n"
+      "}\n"
+      "complete -o default -F _\2_complete \1\n" },
+    { "zsh",
+      "#compdef \1\n"
+      "_\2_complete() {\n"
+      "    local -a matches\n"
+      "    matches=(${(f)\"$(CMDAPP_COMPLETE=$((CURRENT - 1)) "
+      "\"${words[@]}\" 2>/dev/null)\"})\n"
+      "    if (( ${#matches} )); then\n"
+      "        compadd -S '' -- ${(M)matches:#*=}\n"
+      "        compadd -- ${matches:#*=}\n"
+      "    else\n"
+      "        _files\n"
+      "    fi\n"
+      "}\n"
+      "compdef _\2_complete \1\n" },
+    { "fish",
+      "function __\2_complete\n"
+      "    set -l words (commandline -opc)\n"
+      "    env CMDAPP_COMPLETE=(count $words) $words (commandline -ct) "
+      "2>/dev/null\n"
+      "end\n"
+      "complete -c \1 -a '(__\2_complete)'\n" }
+};
+
+int cmdapp_print_completion(cmdapp_t* app, const char* shell) {
+    const char* script = NULL;
+    for (size_t i = 0; i < sizeof(_completion_scripts)
+                           / sizeof(*_completion_scripts); i++) {
+        if (strcmp(_completion_scripts[i].shell, shell) == 0) {
+            script = _completion_scripts[i].script;
+        }
+    }
+    if (script == NULL) {
+        return EXIT_FAILURE;
+    }
+    const char* program = app->_spec._info.program;
+    char buffer[2048];
+    cmdapp_text_t out = { buffer, 0, sizeof(buffer) };
+    for (const char* c = script; *c; c++) {
+        if (*c == '\1') {
+            cmdapp_text_puts(&out, program);
+        } else if (*c == '\2') {
+            for (const char* p = program; *p; p++) {
+                const bool word = (*p >= 'a' && *p <= 'z')
+                                  || (*p >= 'A' && *p <= 'Z')
+                                  || (*p >= '0' && *p <= '9');
+                cmdapp_text_put(&out, word ? p : "_", 1);
+            }
+        } else {
+            cmdapp_text_put(&out, c, 1);
+        }
+    }
+    if (out.length > out.capacity) {
+        return EXIT_FAILURE;
+    }
+    cmdapp_write_stdout(out.data, out.length);
+    return EXIT_SUCCESS;
+}
+
+int cmdapp_run(cmdapp_t* app) {
+    // A shell asking for completions, or for the script that asks for them,
+    // is answered before anything is parsed.
+    const char* request = app->_spec._mode & CMDAPP_MODE_COMPLETE
+                          ? getenv("CMDAPP_COMPLETE") : NULL;
+    if (request != NULL && *request) {
+        int status;
+        if (*request >= '0' && *request <= '9') {
+            status = cmdapp_complete(app, app->_argc, app->_argv,
+                                     atoi(request));
+        } else {
+            status = cmdapp_print_completion(app, request);
+            if (status != EXIT_SUCCESS
+                && (app->_spec._mode & CMDAPP_MODE_PRINT)) {
+                cmdapp_error(app, "Cannot complete for shell %s\n",
+                             request);
+            }
+        }
+        app->_result._exit = CMDAPP_EXIT_COMPLETE;
+        return status;
+    }
+    return cmdapp_run_argv(app, app->_argc, app->_argv);
+}
+
+void cmdapp_enable_stats(cmdapp_t* app, cmdapp_stats_t* stats) {
+    app->_stats = stats;
+    app->_result._stats = stats;
+}
+
+void cmdapp_result_enable_stats(cmdapp_result_t* result,
+                                cmdapp_stats_t* stats) {
+    result->_stats = stats;
+}
+
+cmdargs_t* cmdapp_getargs(cmdapp_t* app) {
+    if (app->_result._args.contents == NULL) {
+        return NULL;
+    }
+    return &app->_result._args;
+}
+
+void cmdapp_error(cmdapp_t* app, const char* fmt, ...) {
+    const char* program = app->_spec._info.program;
+    const char* label = "error: ";
+    #ifdef _POSIX_VERSION
+    if (isatty(STDERR_FILENO) || (getenv("CMDAPP_COLOR_ALWAYS") != NULL)) {
+        label = _COL_RED "error: " _COL_RESET;
+    }
+    #endif /* _POSIX_VERSION */
+    // stderr is unbuffered, so the message is assembled first and written at
+    // once, keeping messages from different threads apart.
+    char message[1024];
+    const int prefix = snprintf(message, sizeof(message), "%s: %s", program,
+                                label);
+    va_list valist;
+    va_start(valist, fmt);
+    const int body = prefix < 0 ? -1
+                     : vsnprintf(message + prefix, sizeof(message) - prefix,
+                                 fmt, valist);
+    va_end(valist);
+    if (body >= 0 && (size_t)(prefix + body) < sizeof(message)) {
+        fwrite(message, 1, (size_t)(prefix + body), stderr);
+        return;
+    }
+    // Too long for the buffer
+    fprintf(stderr, "%s: %s", program, label);
     va_start(valist, fmt);
     vfprintf(stderr, fmt, valist);
     va_end(valist);
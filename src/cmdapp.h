@@ -22,6 +22,32 @@
 #include <stddef.h>
 #include <stdlib.h>
 
+// Gives a function default visibility, so that it stays exported from
+// libcmdapp.so, which is built with -fvisibility=hidden.
+#if defined(__GNUC__)
+#define CMDAPP_EXPORT __attribute__((visibility("default")))
+#else
+#define CMDAPP_EXPORT
+#endif
+
+// With CMDAPP_IMPLEMENTATION defined before it is included, this header also
+// compiles the library into the including file (`make single` writes the
+// same as one self-contained header). The library's functions are then
+// static to that file and the small accessors, marked CMDAPP_INLINE, static
+// inline, so checks and typed accessors compile down to direct loads in
+// their callers. Each file that defines it gets a copy of its own.
+#ifdef CMDAPP_IMPLEMENTATION
+#if defined(__GNUC__)
+#define CMDAPP_API static __attribute__((unused))
+#else
+#define CMDAPP_API static
+#endif
+#define CMDAPP_INLINE static inline
+#else
+#define CMDAPP_API CMDAPP_EXPORT
+#define CMDAPP_INLINE CMDAPP_EXPORT
+#endif
+
 // So it works on windows
 #ifndef EXIT_FAILURE
 #define EXIT_FAILURE 1
@@ -30,14 +56,29 @@
 #define EXIT_SUCCESS 0
 #endif
 
-typedef uint8_t cmdopt_flags_t;
+typedef uint16_t cmdopt_flags_t;
 typedef uint8_t cmdapp_mode_t;
 
+// The converted value of a typed option, in the member its type names.
+typedef union {
+    int64_t i;
+    uint64_t u;
+    double d;
+    bool b;
+} cmdopt_value_t;
+
 typedef struct {
     char shorto;
     const char* longo;
     const char* value;
     cmdopt_flags_t flags;
+    // The value converted to the option's type, or zero if it has none
+    cmdopt_value_t typed;
+    // Every value of a CMDOPT_MULTI option, in order
+    const char* const* values;
+    size_t count;
+    // Position of the option in its app's table, set on registration
+    size_t _id;
 } cmdopt_t;
 
 #define CMDOPT_EXISTS     0b00000001
@@ -45,20 +86,221 @@ typedef struct {
 #define CMDOPT_TAKESARG   0b00000100
 #define CMDOPT_MAYTAKEARG 0b00001000
 
+// Value types, converted once per run. All but CMDOPT_BOOL take an argument,
+// as if CMDOPT_TAKESARG were given. CMDOPT_BOOL may take one, as if
+// CMDOPT_MAYTAKEARG were given, and is true when passed without one. The
+// separate argument of a short CMDOPT_INT or CMDOPT_DOUBLE option may be a
+// negative number, as in `-n -5`.
+#define CMDOPT_TYPE_MASK  0b01110000
+// Decimal integer with an optional sign, in typed.i
+#define CMDOPT_INT        0b00010000
+// Decimal integer without a sign, in typed.u
+#define CMDOPT_UINT       0b00100000
+// Decimal floating point number with an optional exponent, in typed.d
+#define CMDOPT_DOUBLE     0b00110000
+// true, false, yes, no, on, off, 1 or 0, in typed.b
+#define CMDOPT_BOOL       0b01000000
+// Byte count with an optional K, M, G, T, P or E binary suffix, such as 64K
+// or 1.5GiB, in typed.u
+#define CMDOPT_SIZE       0b01010000
+// Time span such as 1h30m, 250ms or 1.5 (seconds), with units d, h, m, s,
+// ms, us and ns, in nanoseconds in typed.u
+#define CMDOPT_DURATION   0b01100000
+
+// Returns `flags` with the argument flag its type implies, unless it already
+// has one.
+#define cmdopt_implied_flags(flags) \
+    ((cmdopt_flags_t)((flags) \
+        | (!((flags) & CMDOPT_TYPE_MASK) \
+           || ((flags) & (CMDOPT_TAKESARG | CMDOPT_MAYTAKEARG)) ? 0 \
+           : ((flags) & CMDOPT_TYPE_MASK) == CMDOPT_BOOL ? CMDOPT_MAYTAKEARG \
+           : CMDOPT_TAKESARG)))
+
+// Collects every occurrence of the option into `values` instead of keeping
+// only the last, which stays in `value`
+#define CMDOPT_MULTI      0b0000000010000000
+// Like CMDOPT_MULTI, but also splits each occurrence at commas, so that
+// `--tag=a,b --tag=c` has the values a, b and c
+#define CMDOPT_SPLIT      0b0000000110000000
+
 #define CMDAPP_MODE_MULTIFLAG 0b00000000
 #define CMDAPP_MODE_SHORTARG  0b00000001
+// Whether cmdapp_run prints parse errors to stderr. Silent apps find them in
+// cmdapp_result_error and format them with cmdapp_format_error on demand.
 #define CMDAPP_MODE_SILENT    0b00000000
 #define CMDAPP_MODE_PRINT     0b00000010
-#define _CMDAPP_MODE_EXIT     0b10000000
+// Hands standalone arguments to the procedure only, without collecting them
+#define CMDAPP_MODE_STREAM    0b00000100
+// Replaces each `@path` argument with the arguments in the file at path
+#define CMDAPP_MODE_RESPONSE  0b00001000
+// Accepts unambiguous prefixes of long option names, such as `--verb`
+#define CMDAPP_MODE_ABBREV    0b00010000
+// Carries on past errors that leave the rest of argv intact, recording up
+// to CMDAPP_MAX_ERRORS of them for cmdapp_result_errors
+#define CMDAPP_MODE_COLLECT   0b00100000
+// Expands standalone arguments containing `*`, `?` or `[` as cmdapp_glob
+// patterns, keeping patterns that match nothing as they are
+#define CMDAPP_MODE_GLOB      0b01000000
+// Lets cmdapp_run answer shell completion requests passed through the
+// CMDAPP_COMPLETE environment variable
+#define CMDAPP_MODE_COMPLETE  0b10000000
+
+// How deeply response files may refer to further response files
+#define CMDAPP_RESPONSE_DEPTH 16
+
+// How many errors a result holds under CMDAPP_MODE_COLLECT
+#define CMDAPP_MAX_ERRORS 8
+
+// Why a parse asked the program to terminate, as reported by
+// cmdapp_result_exit.
+#define CMDAPP_EXIT_HELP     1
+#define CMDAPP_EXIT_VERSION  2
+// A handler returned CMDAPP_STOP
+#define CMDAPP_EXIT_STOP     3
+// The run answered a shell's request for completions
+#define CMDAPP_EXIT_COMPLETE 4
+
+// Checks on the paths given to an option or as standalone arguments, made by
+// cmdapp_run in one batch once argv is parsed.
+typedef uint8_t cmdapp_check_t;
+// The path must exist
+#define CMDAPP_CHECK_EXISTS   0b00000001
+// ...and be a directory
+#define CMDAPP_CHECK_DIR      0b00000010
+// ...and not be a directory
+#define CMDAPP_CHECK_FILE     0b00000100
+// ...and be readable
+#define CMDAPP_CHECK_READABLE 0b00001000
+
+// Most threads cmdapp_check_paths starts on its own, and the fewest paths
+// each of them is given
+#define CMDAPP_CHECK_THREADS 16
+#define CMDAPP_CHECK_SHARE   32
+
+// Threads cmdapp_glob reads directories on by default, and how many of its
+// subtrees are expanded at once
+#define CMDAPP_GLOB_THREADS 8
+#define CMDAPP_GLOB_WINDOW  256
 
 // Returns nonzero if the option was provided to the app
 #define cmdopt_exists(opt)      ((opt).flags & CMDOPT_EXISTS)
 // Returns nonzero if the option was declared as optional
-#define cmdopt_is_optional(opt) ((opt).flags | CMDOPT_OPTIONAL)
+#define cmdopt_is_optional(opt) ((opt).flags & CMDOPT_OPTIONAL)
+// Return the converted value of an option of the matching type
+#define cmdopt_int(opt)         ((opt).typed.i)
+#define cmdopt_uint(opt)        ((opt).typed.u)
+#define cmdopt_double(opt)      ((opt).typed.d)
+#define cmdopt_bool(opt)        ((opt).typed.b)
 
-typedef struct _cmdopt_internal_t cmdopt_internal_t;
+// What a handler wants the run to do next.
+typedef enum {
+    CMDAPP_CONTINUE,
+    // End the run successfully without reading the rest of argv
+    CMDAPP_STOP
+} cmdapp_action_t;
+
+// Called when an option is found, with the value it was given, if any.
+typedef cmdapp_action_t (*cmdopt_handler_t)(void* data, cmdopt_t* option,
+                                            const char* value);
+
+// Describes a registered option. cmdapp_set fills these in at runtime, while
+// static tables declare them with CMDAPP_OPTION.
+typedef struct {
+    char shorto;
+    const char* longo;
+    cmdopt_flags_t flags;
+    const char* description;
+    // NULL-terminated array, or NULL if the option conflicts with nothing
+    cmdopt_t* const* conflicts;
+    // The user-side option that receives the parse results
+    cmdopt_t* result;
+    // Environment variable the option falls back to, or NULL
+    const char* env;
+    // Inclusive bounds on the converted value of a typed option
+    bool ranged;
+    cmdopt_value_t min;
+    cmdopt_value_t max;
+    // Called in place of the app's procedure when the option is found
+    cmdopt_handler_t handler;
+    void* handler_data;
+    // Checks made on every value of the option
+    cmdapp_check_t check;
+} cmdopt_desc_t;
 
+// A compile-time option table declared with CMDAPP_DEFINE_OPTIONS, or
+// generated by tools/cmdapp-gen.
 typedef struct {
+    const cmdopt_desc_t* options;
+    size_t length;
+    // Storage for the index built from the table, so that it needs no
+    // allocation
+    uint64_t* storage;
+    size_t storage_words;
+    // Only in generated tables: a long option lookup specialised for the
+    // table, which returns an option index plus one or zero, the compiled
+    // masks, and the --help text rendered for `info` at `help_width` columns
+    // with info->program as argv[0]
+    uint32_t (*search_long)(const char* name, size_t length);
+    const uint64_t* masks;
+    const struct _cmdapp_info_t* info;
+    const char* help;
+    size_t help_length;
+    size_t help_width;
+} cmdapp_table_t;
+
+// Expands to a cmdopt_desc_t initializer taking the same arguments as
+// cmdapp_set.
+#define CMDAPP_OPTION(shorto_, longo_, flags_, conflicts_, description_, \
+                      option_) \
+    { .shorto = (shorto_), .longo = (longo_), .flags = (flags_), \
+      .description = (description_), .conflicts = (conflicts_), \
+      .result = (option_) }
+
+// Like CMDAPP_OPTION, but also binds the option to an environment variable as
+// cmdapp_set_env does.
+#define CMDAPP_OPTION_ENV(shorto_, longo_, flags_, conflicts_, description_, \
+                          option_, env_) \
+    { .shorto = (shorto_), .longo = (longo_), .flags = (flags_), \
+      .description = (description_), .conflicts = (conflicts_), \
+      .result = (option_), .env = (env_) }
+
+// Like CMDAPP_OPTION, but also gives the option a handler as
+// cmdapp_set_handler does.
+#define CMDAPP_OPTION_HANDLER(shorto_, longo_, flags_, conflicts_, \
+                              description_, option_, handler_, data_) \
+    { .shorto = (shorto_), .longo = (longo_), .flags = (flags_), \
+      .description = (description_), .conflicts = (conflicts_), \
+      .result = (option_), .handler = (handler_), .handler_data = (data_) }
+
+// Expands to a static NULL-terminated conflict list for CMDAPP_OPTION.
+#define CMDAPP_CONFLICTS(...) ((cmdopt_t* const[]){ __VA_ARGS__, NULL })
+
+// Number of long option index slots needed for `n` options.
+#define _CMDAPP_SLOTS(n) \
+    ((n) * 2 <= 8 ? 8 : (n) * 2 <= 16 ? 16 : (n) * 2 <= 32 ? 32 : \
+     (n) * 2 <= 64 ? 64 : (n) * 2 <= 128 ? 128 : (n) * 2 <= 256 ? 256 : \
+     (n) * 2 <= 512 ? 512 : (n) * 2 <= 1024 ? 1024 : \
+     (n) * 2 <= 2048 ? 2048 : (n) * 2 <= 4096 ? 4096 : \
+     (n) * 2 <= 8192 ? 8192 : (n) * 2 <= 16384 ? 16384 : 32768)
+
+// Number of index words needed for `n` options in the worst case, where every
+// option has conflicts and an environment variable.
+#define _CMDAPP_INDEX_WORDS(n) \
+    (_CMDAPP_SLOTS(n) + 2 * (n) + ((n) * sizeof(cmdopt_flags_t) + 7) / 8 \
+     + (((n) + 63) / 64) * (3 + (n)))
+
+// Defines a cmdapp_table_t called `name` from a list of CMDAPP_OPTIONs. Use
+// it at file scope so that the table and its conflict lists are static.
+#define CMDAPP_DEFINE_OPTIONS(name, ...) \
+    static const cmdopt_desc_t name##_options[] = { __VA_ARGS__ }; \
+    static uint64_t name##_storage[_CMDAPP_INDEX_WORDS( \
+        sizeof(name##_options) / sizeof(cmdopt_desc_t))]; \
+    static const cmdapp_table_t name = { \
+        name##_options, sizeof(name##_options) / sizeof(cmdopt_desc_t), \
+        name##_storage, sizeof(name##_storage) / sizeof(uint64_t) \
+    }
+
+typedef struct _cmdapp_info_t {
     const char* program;
     const char** synopses;
     const char* version;
@@ -76,58 +318,554 @@ typedef struct {
 
 typedef void (*cmdapp_procedure_t)(void *data, cmdopt_t* option, const char* arg);
 
+// Lookup tables built from the registered options on the first cmdapp_run.
+// Entries hold an option index plus one, so that zero marks an empty slot.
+// Everything but the short table lives in one block of storage.
+typedef struct {
+    bool _built;
+    uint32_t _short[256];
+    uint64_t* _storage;
+    bool _storage_owned;
+    uint32_t* _long;
+    size_t _long_mask;
+    // Per-option long name length and hash
+    uint64_t* _keys;
+    cmdopt_flags_t* _flags;
+    // Required and conflicting options compiled into bitsets
+    uint64_t* _masks;
+    // Hash table of bound environment variable names, if any
+    uint32_t* _env;
+    size_t _env_mask;
+    // Options with long names sorted by name, in CMDAPP_MODE_ABBREV
+    const cmdopt_desc_t** _sorted;
+    size_t _sorted_length;
+    // The generated lookup of an unchanged generated table, which replaces
+    // the long option hash table
+    uint32_t (*_search)(const char* name, size_t length);
+} cmdapp_index_t;
+
+// A caller-supplied buffer that an app bump-allocates from.
+typedef struct {
+    char* _base;
+    size_t _size;
+    // End of the growable blocks at the bottom of the arena
+    size_t _used;
+    // Offset of the most recent growable block, which may grow in place
+    size_t _last;
+    // Start of the fixed-size blocks at the top of the arena
+    size_t _top;
+} cmdapp_arena_t;
+
+// A response or config file, rewritten in place. It stays open for as long
+// as anything may refer to its contents.
+typedef struct {
+    char* _base;
+    size_t _size;
+    bool _mapped;
+    // Where a response file came from and when it was last modified, in
+    // nanoseconds, so that cached results can tell whether it changed
+    const char* _path;
+    int64_t _mtime;
+} cmdapp_file_t;
+
+// The immutable part of an app: its registered options and the index built
+// from them. Once obtained from cmdapp_get_spec it may be shared by any
+// number of threads calling cmdapp_parse.
 typedef struct {
-    int _argc;
-    char** _argv;
     cmdapp_mode_t _mode;
     cmdapp_info_t _info;
     int _custom_help;
     int _custom_ver;
     size_t _length;
     size_t _capacity;
-    cmdopt_internal_t** _start;
+    cmdopt_desc_t* _start;
+    const cmdapp_table_t* _table;
+    size_t _static_length;
+    cmdapp_index_t _index;
+    // Settings from cmdapp_load_config: a value (or, for options without
+    // arguments, any non-NULL pointer) per option and the options set
+    cmdapp_file_t _config;
+    const char** _config_values;
+    size_t* _config_ids;
+    size_t _config_count;
+} cmdapp_spec_t;
+
+typedef enum {
+    CMDAPP_OK,
+    CMDAPP_ERR_NOMEM,
+    CMDAPP_ERR_UNKNOWN,
+    CMDAPP_ERR_EXPECTS_ARG,
+    CMDAPP_ERR_NO_ARG,
+    CMDAPP_ERR_REQUIRED,
+    CMDAPP_ERR_CONFLICT,
+    CMDAPP_ERR_RESPONSE,
+    CMDAPP_ERR_RESPONSE_DEPTH,
+    CMDAPP_ERR_AMBIGUOUS,
+    CMDAPP_ERR_INVALID,
+    CMDAPP_ERR_RANGE,
+    CMDAPP_ERR_PATH
+} cmdapp_errcode_t;
+
+// Describes why a parse failed.
+typedef struct {
+    cmdapp_errcode_t code;
+    // argv index of the offending entry, or -1 if the error concerns the
+    // options as a whole
+    int index;
+    // The offending flag within argv[index]: a single character for short
+    // flags and the whole `--name` for long ones. For response file errors,
+    // the whole `@path`.
+    const char* text;
+    size_t length;
+    // Index of the offending option, and of the one it conflicts with
+    size_t option;
+    size_t other;
+    // For an ambiguous abbreviation, the run of options it could stand for
+    // in the spec's sorted long name index, and whether --help and --version
+    // are candidates as well
+    size_t candidates;
+    size_t candidate_count;
+    bool help_candidate;
+    bool version_candidate;
+    // For a path that failed its checks, the errno saying why
+    int path_errno;
+} cmdapp_err_t;
+
+// Counters filled in by parses once enabled with cmdapp_enable_stats. They
+// accumulate across parses; zero them to start over. Building the library
+// with -DCMDAPP_STATS=0 compiles all instrumentation out, leaving them zero.
+typedef struct {
+    // Time spent classifying argv entries, excluding lookups
+    uint64_t tokenize_ns;
+    // Time spent looking up options
+    uint64_t lookup_ns;
+    // Time spent in required and conflict validation
+    uint64_t resolve_ns;
+    // Option lookups, and hash table slots or table entries visited by them
+    uint64_t lookups;
+    uint64_t probes;
+    // Allocations (from the heap or an arena) and their total size
+    uint64_t allocations;
+    uint64_t allocated_bytes;
+    // Calls to the procedure
+    uint64_t callbacks;
+} cmdapp_stats_t;
+
+struct _cmdapp_t;
+
+// The outcome of one parse against a spec.
+typedef struct {
+    const cmdapp_spec_t* _spec;
+    // The app whose allocator backs this result, or NULL for the heap
+    struct _cmdapp_t* _owner;
+    size_t _length;
+    uint64_t* _exists;
+    const char** _values;
+    cmdopt_value_t* _typed;
+    // Occurrences of CMDOPT_MULTI options in order of appearance, and the
+    // buffer holding the pieces of split values
+    struct _cmdapp_occurrence* _occurrences;
+    size_t _occurrences_length;
+    size_t _occurrences_capacity;
+    char* _pieces;
+    size_t _pieces_length;
+    size_t _pieces_capacity;
+    // Blocks holding the arguments glob patterns expanded to, which later
+    // parses reuse
+    struct _cmdapp_block* _blocks;
+    // Whether the last parse expanded a glob pattern, which makes its result
+    // depend on the contents of directories
+    bool _globbed;
+    // The values of every CMDOPT_MULTI option, grouped by option in order of
+    // appearance, and where each option's run starts
+    const char** _multi;
+    size_t _multi_capacity;
+    size_t* _multi_start;
+    size_t* _multi_count;
+    // Options set by the last parse, so that the next one can clear them
+    size_t* _touched;
+    size_t _touched_length;
     cmdargs_t _args;
+    size_t _args_capacity;
+    // Where the standalone arguments start in _args, past the program name
+    // that argv[0] gave
+    size_t _args_from;
+    cmdapp_file_t* _files;
+    size_t _files_length;
+    size_t _files_capacity;
+    // The first error of a failed parse, and under CMDAPP_MODE_COLLECT every
+    // error kept, in the order found
+    cmdapp_err_t _error;
+    cmdapp_err_t _errors[CMDAPP_MAX_ERRORS];
+    size_t _error_count;
+    int _exit;
+    cmdapp_stats_t* _stats;
+} cmdapp_result_t;
+
+// Registers the options of a subcommand on the app, once argv selects it.
+typedef void (*cmdapp_setup_t)(struct _cmdapp_t* app, void* user_data);
+
+typedef struct {
+    const char* name;
+    const char* description;
+    cmdapp_setup_t setup;
+    void* user_data;
+} cmdapp_subcommand_t;
+
+typedef struct _cmdapp_t {
+    int _argc;
+    char** _argv;
+    cmdapp_spec_t _spec;
+    cmdapp_result_t _result;
     cmdapp_procedure_t _proc;
     void *_user_data;
+    cmdapp_stats_t* _stats;
+    cmdapp_arena_t _arena;
+    bool _oom;
+    cmdapp_subcommand_t* _subcommands;
+    size_t _subcommands_length;
+    size_t _subcommands_capacity;
+    // Hash table of subcommand names, built on the first run after changes
+    uint32_t* _subcommand_slots;
+    size_t _subcommand_mask;
+    // The subcommand set up by the last run plus one, or zero, and the number
+    // of options registered before its setup
+    size_t _selected;
+    size_t _base_length;
+    // Rendered --help and --version output. The help is stale once options
+    // or subcommands are added, and also depends on the length of argv[0]
+    // and the terminal width.
+    char* _help;
+    size_t _help_length;
+    size_t _help_program;
+    size_t _help_width;
+    bool _help_stale;
+    char* _version;
+    size_t _version_length;
+    // Checks made on standalone arguments
+    cmdapp_check_t _arg_check;
+    // The directory results are cached in, or NULL, and the cache entry the
+    // last run's result was read from
+    const char* _cache_dir;
+    cmdapp_file_t _cache;
 } cmdapp_t;
 
 // Returns nonzero if the program should terminate. Zero otherwise.
-#define cmdapp_should_exit(app) ((app)->_mode & _CMDAPP_MODE_EXIT)
+#define cmdapp_should_exit(app) ((app)->_result._exit)
 
 // Initializes a cmdapp_t with the given program environment, mode and metadata.
-void cmdapp_init(cmdapp_t* app, int argc, char** argv, cmdapp_mode_t mode,
-                 const cmdapp_info_t* info);
+CMDAPP_API void cmdapp_init(cmdapp_t* app, int argc, char** argv,
+                            cmdapp_mode_t mode, const cmdapp_info_t* info);
+
+// Initializes a cmdapp_t like cmdapp_init, but uses the options of a table
+// declared with CMDAPP_DEFINE_OPTIONS in place. Neither this nor the first
+// cmdapp_run allocates memory for the options. Apps sharing a table must not
+// be initialized or first run concurrently.
+CMDAPP_API void cmdapp_init_static(cmdapp_t* app, int argc, char** argv,
+                                   cmdapp_mode_t mode,
+                                   const cmdapp_info_t* info,
+                                   const cmdapp_table_t* table);
 
-// Destroys the given cmdapp_t. Any subsequent member access is undefined.
-void cmdapp_destroy(cmdapp_t* app);
+// Initializes a cmdapp_t like cmdapp_init, but allocates the option table,
+// conflict lists, lookup index and argument list from the given buffer
+// instead of the heap. If the buffer runs out, cmdapp_run fails. The buffer
+// must outlive the app and be aligned for any type.
+CMDAPP_API void cmdapp_init_arena(cmdapp_t* app, void* buffer, size_t size,
+                                  int argc, char** argv, cmdapp_mode_t mode,
+                                  const cmdapp_info_t* info);
+
+// Destroys the given cmdapp_t. Any subsequent member access is undefined. An
+// arena-backed app is released with a single reset of its arena.
+CMDAPP_API void cmdapp_destroy(cmdapp_t* app);
 
 // Registers an option to the app with the given values and flags
-void cmdapp_set(cmdapp_t* app, char shorto, const char* longo, uint8_t flags,
-                cmdopt_t** conflicts, const char* description,
-                cmdopt_t* option);
+CMDAPP_API void cmdapp_set(cmdapp_t* app, char shorto, const char* longo,
+                           cmdopt_flags_t flags, cmdopt_t** conflicts,
+                           const char* description, cmdopt_t* option);
+
+// Makes cmdapp_run call `handler` with `data` each time the option is found,
+// instead of the app's procedure. Its value is the one just found, before
+// typed conversion and validation. If the handler returns CMDAPP_STOP, the
+// run ends there with EXIT_SUCCESS and cmdapp_should_exit returns
+// CMDAPP_EXIT_STOP; arguments after it are not read and required options and
+// conflicts are not checked. Standalone cmdapp_parse calls no handlers.
+CMDAPP_API void cmdapp_set_handler(cmdapp_t* app, cmdopt_t* option,
+                                   cmdopt_handler_t handler, void* data);
+
+// Makes cmdapp_run check every value of the option as a path once argv is
+// parsed, with `checks` a combination of CMDAPP_CHECK_* flags. All values
+// and arguments with checks are checked together in one parallel batch;
+// each one failing becomes a CMDAPP_ERR_PATH error with its `path_errno`.
+// Standalone cmdapp_parse checks nothing.
+CMDAPP_API void cmdapp_set_check(cmdapp_t* app, cmdopt_t* option,
+                                 cmdapp_check_t checks);
+
+// Makes cmdapp_run check every standalone argument as cmdapp_set_check does
+// for option values. Arguments are not checked in CMDAPP_MODE_STREAM.
+CMDAPP_API void cmdapp_set_arg_check(cmdapp_t* app, cmdapp_check_t checks);
+
+// Binds a registered option to the environment variable `name`. Options that
+// a parse leaves unset are taken from their variables, before required
+// options and conflicts are checked, so the command line always wins. Empty
+// variables count as unset. `name` must outlive the app.
+CMDAPP_API void cmdapp_set_env(cmdapp_t* app, cmdopt_t* option,
+                               const char* name);
+
+// Registers a subcommand, selected when it is the first argument of a run.
+// Its setup callback is then called to register the subcommand's options
+// alongside those already registered on the app, so only the selected
+// subcommand ever pays for its options. The rest of argv is then parsed as if
+// the subcommand name were argv[0]. The name and description must outlive
+// the app.
+CMDAPP_API void cmdapp_add_subcommand(cmdapp_t* app, const char* name,
+                                      const char* description,
+                                      cmdapp_setup_t setup, void* user_data);
+
+// Returns the name of the subcommand selected by the last run, or NULL.
+CMDAPP_INLINE const char* cmdapp_subcommand(const cmdapp_t* app);
+
+// Bounds the converted value of a typed option to [min, max], with the bounds
+// in the member its type uses. Values outside fail the run.
+CMDAPP_API void cmdapp_set_range(cmdapp_t* app, cmdopt_t* option,
+                                 cmdopt_value_t min, cmdopt_value_t max);
+
+// Converts the whole of `str` to a value of the given CMDOPT_* type, without
+// consulting the locale. Returns CMDAPP_OK, CMDAPP_ERR_INVALID if `str` is
+// not of that type, or CMDAPP_ERR_RANGE if it does not fit.
+CMDAPP_API cmdapp_errcode_t cmdapp_convert(const char* str, cmdopt_flags_t type,
+                                           cmdopt_value_t* value);
+
+// Loads default option values from the file at `path`, which holds `key =
+// value` lines keyed by long option name. Blank lines, lines starting with
+// `#` or `;` and `[section]` headers are skipped, and values may be double
+// quoted. Options without arguments take `true`, `yes`, `on` or `1` (or no
+// value at all) to set them and `false`, `no`, `off` or `0` to leave them
+// unset. Runs use these settings for options left unset by both the command
+// line and the environment. Loading again replaces the previous file. Load
+// after registering options; returns EXIT_SUCCESS on success and
+// EXIT_FAILURE otherwise, printing why.
+CMDAPP_API int cmdapp_load_config(cmdapp_t* app, const char* path);
 
 // Generates a --help output to stdout. If cmdapp_info was not called, the
 // function behavior is undefined
-void cmdapp_print_help(cmdapp_t* app);
+CMDAPP_API void cmdapp_print_help(cmdapp_t* app);
 
 // Generates a --version output to stdout. If cmdapp_info was not called, the
 // function behavior is undefined
-void cmdapp_print_version(cmdapp_t* app);
+CMDAPP_API void cmdapp_print_version(cmdapp_t* app);
 
 // Sets the cmdapp_t's procedural parsing function to the given function. If set
 // to NULL, it disables procedural parsing (default).
 // user_data will be passed as an argument to the procedure
-void cmdapp_enable_procedure(cmdapp_t* app, cmdapp_procedure_t proc, void *user_data);
+CMDAPP_API void cmdapp_enable_procedure(cmdapp_t* app, cmdapp_procedure_t proc,
+                                        void *user_data);
+
+// Makes the app record parse and allocation counters into `stats`, or stops
+// it if NULL. Enable it before registering options to count their
+// allocations too.
+CMDAPP_API void cmdapp_enable_stats(cmdapp_t* app, cmdapp_stats_t* stats);
+
+// Makes cmdapp_run keep the results of successful runs in files in the existing
+// directory `dir`, or stops it if NULL. A run whose argv, working directory,
+// bound environment variables, config file settings, options and response files
+// match those of a cached run takes its result from the cache without parsing,
+// and values then point into the cache entry until the next run. Path checks
+// are replayed, not redone. Runs that expand a glob pattern, and apps with a
+// procedure or handlers, are never cached. Entries are replaced atomically, so
+// processes may share a directory. `dir` must outlive the app. Only available
+// with POSIX.
+CMDAPP_API void cmdapp_enable_cache(cmdapp_t* app, const char* dir);
 
 // Returns EXIT_SUCCESS on success and EXIT_FAILURE otherwise (printing a
-// diagnostic to stderr if configured)
-int cmdapp_run(cmdapp_t* app);
+// diagnostic to stderr if configured). In CMDAPP_MODE_COMPLETE, if the
+// environment variable CMDAPP_COMPLETE holds a number, the run instead
+// answers cmdapp_complete for the word at that position of argv, and if it
+// names a shell, prints that shell's script as cmdapp_print_completion does,
+// failing for other shells. Either way cmdapp_should_exit then returns
+// CMDAPP_EXIT_COMPLETE. Only the parse is skipped: whatever the program does
+// before cmdapp_run, such as registering options, still runs for every
+// completion, so call it before any expensive initialisation.
+CMDAPP_API int cmdapp_run(cmdapp_t* app);
+
+// Writes the completions of argv[cursor] to stdout in a single write, one per
+// line, for a command line whose earlier words are in argv: subcommand names
+// for the first argument and matching option names for words starting with
+// a dash, with a `=` after options that need an argument. Nothing is written
+// where the shell should complete file names, such as for arguments and the
+// arguments of options. Only the subcommand named by argv[1] is set up.
+// Returns EXIT_SUCCESS, or EXIT_FAILURE if out of memory.
+CMDAPP_API int cmdapp_complete(cmdapp_t* app, int argc, char** argv,
+                               int cursor);
+
+// Writes the script that hooks the program into the completion of `shell`,
+// which is "bash", "zsh" or "fish", to stdout. Returns EXIT_FAILURE for
+// other shells.
+CMDAPP_API int cmdapp_print_completion(cmdapp_t* app, const char* shell);
+
+// Like cmdapp_run, but parses the given argument vector instead of the one
+// the app was initialized with. The results of the previous run are cleared
+// first, at a cost proportional to the options it set rather than to the
+// number registered, so one app can be reused for many command lines.
+CMDAPP_API int cmdapp_run_argv(cmdapp_t* app, int argc, char** argv);
+
+// Returns the result of the app's last run, for cmdapp_serialize and
+// cmdapp_deserialize among others.
+CMDAPP_INLINE cmdapp_result_t* cmdapp_get_result(cmdapp_t* app);
 
 // Returns a pointer to an array of standalone command line arguments, or NULL
-// if none exist.
-cmdargs_t* cmdapp_getargs(cmdapp_t* app);
+// if none exist. Always NULL in CMDAPP_MODE_STREAM.
+CMDAPP_INLINE cmdargs_t* cmdapp_getargs(cmdapp_t* app);
+
+// Finishes building the app's option index and returns its immutable spec, or
+// NULL if out of memory. The spec stays valid until the next cmdapp_set or
+// cmdapp_destroy on the app.
+CMDAPP_API const cmdapp_spec_t* cmdapp_get_spec(cmdapp_t* app);
+
+// Looks up the long option named by the first `length` bytes of `name`, which
+// need not be NUL-terminated there, and sets `id` to its position in the app's
+// table. Under CMDAPP_MODE_ABBREV an unambiguous prefix also matches. Returns
+// CMDAPP_OK, CMDAPP_ERR_UNKNOWN or CMDAPP_ERR_AMBIGUOUS.
+CMDAPP_API cmdapp_errcode_t cmdapp_find_long(const cmdapp_spec_t* spec,
+                                             const char* name, size_t length,
+                                             size_t* id);
+
+// Prepares a result for parses against the given spec. Returns EXIT_SUCCESS,
+// or EXIT_FAILURE if out of memory.
+CMDAPP_API int cmdapp_result_init(cmdapp_result_t* result,
+                                  const cmdapp_spec_t* spec);
+
+// Frees the memory held by a result.
+CMDAPP_API void cmdapp_result_destroy(cmdapp_result_t* result);
+
+// Parses an argument vector against a spec into a result, without writing to
+// argv, the spec or the user-side options and without printing anything.
+// Threads may parse concurrently as long as each uses its own result. Returns
+// EXIT_SUCCESS on success and EXIT_FAILURE otherwise, in which case
+// cmdapp_result_error describes the failure.
+CMDAPP_API int cmdapp_parse(const cmdapp_spec_t* spec, int argc,
+                            char* const* argv, cmdapp_result_t* result);
+
+// Parses `n` argument vectors against a spec on `nthreads` threads (zero picks
+// one per processor), writing item i into results[i]. Each result must have
+// been initialized with cmdapp_result_init for the spec. Nothing is printed;
+// failed items carry their error in their result. Returns the number of items
+// that failed.
+CMDAPP_API size_t cmdapp_run_batch(const cmdapp_spec_t* spec, size_t n,
+                                   const int* argcs, char* const* const* argvs,
+                                   cmdapp_result_t* results, size_t nthreads);
+
+// Checks each of `n` paths against the CMDAPP_CHECK_* flags in checks[i] on
+// `nthreads` threads (zero picks up to CMDAPP_CHECK_THREADS of them), setting
+// errors[i] to zero if it passes or to the errno of the first check it
+// fails. Returns the number of paths that failed.
+CMDAPP_API size_t cmdapp_check_paths(size_t n, const char* const* paths,
+                                     const cmdapp_check_t* checks, int* errors,
+                                     size_t nthreads);
+
+// Called by cmdapp_glob with a matching path, which is only valid during the
+// call. Returns whether to carry on.
+typedef bool (*cmdapp_match_t)(void* data, const char* path, size_t length);
+
+// Calls `match` with every existing path the glob pattern matches. Between
+// slashes, `*`, `?` and `[...]` match names as fnmatch does, except that
+// names starting with a dot need the pattern to start with one, and `**`
+// matches any number of directories, or everything below when last, without
+// following links. Each directory's entries are taken in name order, so the
+// matches come in a stable order. Directories are read on `nthreads` threads
+// (zero picks CMDAPP_GLOB_THREADS), a window of subtrees at a time, so that
+// the matches held at once stay bounded. Returns EXIT_SUCCESS, or
+// EXIT_FAILURE if out of memory. Without POSIX directories nothing matches.
+CMDAPP_API int cmdapp_glob(const char* pattern, size_t nthreads,
+                           cmdapp_match_t match, void* data);
+
+// Writes the result of a successful parse into `buffer`, which must be
+// aligned to eight bytes, if it holds `size` bytes, and returns the size it
+// takes, or zero if the result is too large to serialise. The copy holds no
+// pointers, so it may be written to a pipe or shared memory as it is: an
+// exists bitset and the typed values indexed by option, and every value and
+// argument as an offset into one string blob. It can only be read back on
+// machines of the same byte order, against the same options.
+CMDAPP_API size_t cmdapp_serialize(const cmdapp_result_t* result, void* buffer,
+                                   size_t size);
+
+// Makes `result` hold the parse serialised at `data`, whose strings its
+// values and arguments then point into, so `data` must stay unchanged while
+// it is used. `data` must be aligned to eight bytes. For an app's result,
+// the user-side options are set as cmdapp_run sets them. Returns
+// EXIT_SUCCESS, or EXIT_FAILURE if `data` is not a serialised result for
+// the result's spec or memory runs out.
+CMDAPP_API int cmdapp_deserialize(cmdapp_result_t* result, const void* data,
+                                  size_t size);
+
+// Makes parses into the result record counters into `stats`, or stops it if
+// NULL. Results parsed concurrently need separate counters.
+CMDAPP_API void cmdapp_result_enable_stats(cmdapp_result_t* result,
+                                           cmdapp_stats_t* stats);
+
+// Returns true if the option was provided in the parse.
+CMDAPP_INLINE bool cmdapp_result_exists(const cmdapp_result_t* result,
+                                        const cmdopt_t* option);
+
+// Returns the argument given to the option, or NULL if it has none.
+CMDAPP_INLINE const char* cmdapp_result_value(const cmdapp_result_t* result,
+                                              const cmdopt_t* option);
+
+// Returns the converted value of a typed option, or zero (false) if it was not
+// provided in the parse.
+CMDAPP_INLINE int64_t cmdapp_result_int(const cmdapp_result_t* result,
+                                        const cmdopt_t* option);
+CMDAPP_INLINE uint64_t cmdapp_result_uint(const cmdapp_result_t* result,
+                                          const cmdopt_t* option);
+CMDAPP_INLINE double cmdapp_result_double(const cmdapp_result_t* result,
+                                          const cmdopt_t* option);
+CMDAPP_INLINE bool cmdapp_result_bool(const cmdapp_result_t* result,
+                                      const cmdopt_t* option);
+
+// Returns the values given to a CMDOPT_MULTI option in order, and sets
+// `count` to their number, which is zero if it was not provided.
+CMDAPP_INLINE const char* const* cmdapp_result_values(
+    const cmdapp_result_t* result, const cmdopt_t* option, size_t* count);
+
+// Returns the standalone command line arguments of the parse, which are empty
+// in CMDAPP_MODE_STREAM.
+CMDAPP_INLINE const cmdargs_t* cmdapp_result_args(
+    const cmdapp_result_t* result);
+
+// Returns why the parse failed, or NULL if it succeeded.
+CMDAPP_INLINE const cmdapp_err_t* cmdapp_result_error(
+    const cmdapp_result_t* result);
+
+// Returns every error of a failed parse in the order found, and sets `count`
+// to their number. Without CMDAPP_MODE_COLLECT there is at most one.
+CMDAPP_INLINE const cmdapp_err_t* cmdapp_result_errors(
+    const cmdapp_result_t* result, size_t* count);
+
+// Writes the message for an error into `buffer`, truncating it to `size`
+// bytes with its terminator like snprintf, and returns its full length.
+CMDAPP_API size_t cmdapp_format_error(const cmdapp_spec_t* spec,
+                                      const cmdapp_err_t* error, char* buffer,
+                                      size_t size);
+
+// Returns CMDAPP_EXIT_HELP or CMDAPP_EXIT_VERSION if the parse stopped at
+// --help or --version, CMDAPP_EXIT_STOP if a handler stopped it,
+// CMDAPP_EXIT_COMPLETE if it answered a shell, and zero otherwise.
+#define cmdapp_result_exit(result) ((result)->_exit)
+
+// Writes the --help text of the app into `buffer` for a terminal `width`
+// columns wide (or, if zero, the width of the terminal on stdout), truncating
+// it to `size` bytes with its terminator like snprintf, and returns its full
+// length.
+CMDAPP_API size_t cmdapp_format_help(cmdapp_t* app, char* buffer, size_t size,
+                                     size_t width);
+
+// Prints a formatted error message to stderr, prefixed with the program name,
+// in a single write.
+CMDAPP_API void cmdapp_error(cmdapp_t* app, const char* fmt, ...);
 
-// Prints a formatted error message to stderr.
-void cmdapp_error(cmdapp_t* app, const char* fmt, ...);
+#ifdef CMDAPP_IMPLEMENTATION
+#include "cmdapp.c"
+#include "cmdapp_value.c"
+#include "cmdapp_batch.c"
+#endif /* CMDAPP_IMPLEMENTATION */
 
 #endif /* _CMDAPP_APP_H */
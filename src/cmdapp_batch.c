@@ -0,0 +1,574 @@
+// cmdapp: cmdapp_batch.c
+// Copyright (C) 2021 Ethan Uppal
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "cmdapp.h"
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__unix__) || (defined(__APPLE__) && defined(__MACH__))
+#include <unistd.h>
+#endif
+
+#if defined(_POSIX_VERSION) && !defined(__STDC_NO_ATOMICS__)
+#define CMDAPP_BATCH_THREADS
+#include <pthread.h>
+#include <stdatomic.h>
+#endif
+
+#if defined(_POSIX_VERSION)
+#include <dirent.h>
+#include <fnmatch.h>
+#include <sys/stat.h>
+#endif
+
+// Processes item i of a batch, returning whether it succeeded.
+typedef bool (*cmdapp_item_t)(const void* batch, size_t i);
+
+typedef struct {
+    const cmdapp_spec_t* spec;
+    const int* argcs;
+    char* const* const* argvs;
+    cmdapp_result_t* results;
+} cmdapp_batch_t;
+
+static bool cmdapp_batch_item(const void* data, size_t i) {
+    const cmdapp_batch_t* batch = data;
+    return cmdapp_parse(batch->spec, batch->argcs[i], batch->argvs[i],
+                        &batch->results[i]) == EXIT_SUCCESS;
+}
+
+#ifdef CMDAPP_BATCH_THREADS
+
+// Each worker starts with an even share of the items. Owner and thieves both
+// claim items from the front of a share with a fetch-and-add, so an item is
+// parsed exactly once no matter who gets to it.
+typedef struct {
+    _Alignas(64) atomic_size_t next;
+    size_t end;
+} cmdapp_share_t;
+
+typedef struct {
+    cmdapp_item_t item;
+    const void* batch;
+    cmdapp_share_t* shares;
+    size_t nthreads;
+    size_t self;
+    size_t failures;
+} cmdapp_worker_t;
+
+static bool cmdapp_claim(cmdapp_share_t* share, size_t* item) {
+    if (atomic_load_explicit(&share->next, memory_order_relaxed)
+        >= share->end) {
+        return false;
+    }
+    *item = atomic_fetch_add_explicit(&share->next, 1, memory_order_relaxed);
+    return *item < share->end;
+}
+
+static void* cmdapp_batch_worker(void* data) {
+    cmdapp_worker_t* worker = data;
+    size_t item;
+    for (size_t k = 0; k < worker->nthreads; k++) {
+        // Drain our own share first, then steal from the others in turn.
+        cmdapp_share_t* share
+            = &worker->shares[(worker->self + k) % worker->nthreads];
+        while (cmdapp_claim(share, &item)) {
+            if (!worker->item(worker->batch, item)) {
+                worker->failures++;
+            }
+        }
+    }
+    return NULL;
+}
+
+#endif /* CMDAPP_BATCH_THREADS */
+
+// Runs `item` on each of `n` items on `nthreads` threads, or serially if
+// threads are unavailable, and returns the number that failed.
+static size_t cmdapp_for_each(cmdapp_item_t item, const void* batch, size_t n,
+                              size_t nthreads) {
+    size_t failures = 0;
+
+    #ifdef CMDAPP_BATCH_THREADS
+    if (nthreads > n) {
+        nthreads = n;
+    }
+    cmdapp_share_t* shares = NULL;
+    cmdapp_worker_t* workers = NULL;
+    pthread_t* threads = NULL;
+    if (nthreads > 1) {
+        shares = aligned_alloc(_Alignof(cmdapp_share_t),
+                               nthreads * sizeof(cmdapp_share_t));
+        workers = malloc(nthreads * sizeof(cmdapp_worker_t));
+        threads = malloc(nthreads * sizeof(pthread_t));
+    }
+    if (shares != NULL && workers != NULL && threads != NULL) {
+        for (size_t t = 0; t < nthreads; t++) {
+            atomic_init(&shares[t].next, n * t / nthreads);
+            shares[t].end = n * (t + 1) / nthreads;
+            workers[t] = (cmdapp_worker_t){
+                item, batch, shares, nthreads, t, 0
+            };
+        }
+        // The calling thread is worker zero.
+        size_t started = 1;
+        for (; started < nthreads; started++) {
+            if (pthread_create(&threads[started], NULL, cmdapp_batch_worker,
+                               &workers[started]) != 0) {
+                break;
+            }
+        }
+        // Shares of threads that failed to start are stolen by the others.
+        cmdapp_batch_worker(&workers[0]);
+        for (size_t t = 1; t < started; t++) {
+            pthread_join(threads[t], NULL);
+        }
+        for (size_t t = 0; t < nthreads; t++) {
+            failures += workers[t].failures;
+        }
+        free(shares);
+        free(workers);
+        free(threads);
+        return failures;
+    }
+    free(shares);
+    free(workers);
+    free(threads);
+    #else
+    (void)nthreads;
+    #endif /* CMDAPP_BATCH_THREADS */
+
+    for (size_t i = 0; i < n; i++) {
+        if (!item(batch, i)) {
+            failures++;
+        }
+    }
+    return failures;
+}
+
+size_t cmdapp_run_batch(const cmdapp_spec_t* spec, size_t n,
+                        const int* argcs, char* const* const* argvs,
+                        cmdapp_result_t* results, size_t nthreads) {
+    const cmdapp_batch_t batch = { spec, argcs, argvs, results };
+    #ifdef CMDAPP_BATCH_THREADS
+    if (nthreads == 0) {
+        const long online = sysconf(_SC_NPROCESSORS_ONLN);
+        nthreads = online > 0 ? (size_t)online : 1;
+    }
+    #endif /* CMDAPP_BATCH_THREADS */
+    return cmdapp_for_each(cmdapp_batch_item, &batch, n, nthreads);
+}
+
+typedef struct {
+    const char* const* paths;
+    const cmdapp_check_t* checks;
+    int* errors;
+} cmdapp_path_batch_t;
+
+// Returns zero if `path` passes `checks`, or the errno of the first failure.
+static int cmdapp_check_path(const char* path, cmdapp_check_t checks) {
+    #ifdef _POSIX_VERSION
+    struct stat info;
+    if (stat(path, &info) != 0) {
+        return errno;
+    }
+    if ((checks & CMDAPP_CHECK_DIR) && !S_ISDIR(info.st_mode)) {
+        return ENOTDIR;
+    }
+    if ((checks & CMDAPP_CHECK_FILE) && S_ISDIR(info.st_mode)) {
+        return EISDIR;
+    }
+    if ((checks & CMDAPP_CHECK_READABLE) && access(path, R_OK) != 0) {
+        return errno;
+    }
+    #else
+    // Without stat, only existence and readability can be told, and only
+    // of files.
+    (void)checks;
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        return errno ? errno : ENOENT;
+    }
+    fclose(file);
+    #endif /* _POSIX_VERSION */
+    return 0;
+}
+
+static bool cmdapp_path_item(const void* data, size_t i) {
+    const cmdapp_path_batch_t* batch = data;
+    batch->errors[i] = batch->checks[i]
+                       ? cmdapp_check_path(batch->paths[i], batch->checks[i])
+                       : 0;
+    return batch->errors[i] == 0;
+}
+
+size_t cmdapp_check_paths(size_t n, const char* const* paths,
+                          const cmdapp_check_t* checks, int* errors,
+                          size_t nthreads) {
+    const cmdapp_path_batch_t batch = { paths, checks, errors };
+    if (nthreads == 0) {
+        // Checks mostly wait on the filesystem, so a few threads pay off
+        // even on one processor, but not for a handful of paths.
+        nthreads = n / CMDAPP_CHECK_SHARE;
+        if (nthreads > CMDAPP_CHECK_THREADS) {
+            nthreads = CMDAPP_CHECK_THREADS;
+        }
+    }
+    return cmdapp_for_each(cmdapp_path_item, &batch, n, nthreads);
+}
+
+#ifdef _POSIX_VERSION
+
+// Paths packed one after another with terminators. Listings put a type byte
+// before each name: 'd' for a directory, not reached through a symbolic
+// link, and '-' for anything else.
+typedef struct {
+    char* data;
+    size_t length;
+    size_t capacity;
+    size_t count;
+    bool failed;
+} cmdapp_paths_t;
+
+// A pattern split at slashes into its components.
+typedef struct {
+    char* copy;
+    char** components;
+    size_t count;
+} cmdapp_pattern_t;
+
+static bool _is_magic(const char* component) {
+    return strpbrk(component, "*?[") != NULL;
+}
+
+static bool _is_globstar(const char* component) {
+    return strcmp(component, "**") == 0;
+}
+
+// Appends `base` joined to `name` by a slash, after the byte `type` unless
+// it is zero.
+static void cmdapp_paths_add(cmdapp_paths_t* paths, char type,
+                             const char* base, const char* name) {
+    const size_t base_length = strlen(base);
+    const size_t name_length = strlen(name);
+    const bool slash = base_length && name_length
+                       && base[base_length - 1] != '/';
+    const size_t length = (type != 0) + base_length + slash + name_length + 1;
+    if (paths->failed) {
+        return;
+    }
+    if (paths->length + length > paths->capacity) {
+        size_t capacity = paths->capacity ? paths->capacity * 2 : 256;
+        while (capacity < paths->length + length) capacity *= 2;
+        char* data = realloc(paths->data, capacity);
+        if (data == NULL) {
+            paths->failed = true;
+            return;
+        }
+        paths->data = data;
+        paths->capacity = capacity;
+    }
+    char* write = paths->data + paths->length;
+    if (type) *write++ = type;
+    memcpy(write, base, base_length);
+    write += base_length;
+    if (slash) *write++ = '/';
+    memcpy(write, name, name_length + 1);
+    paths->length += length;
+    paths->count++;
+}
+
+static int _compare_names(const void* a, const void* b) {
+    // Skip the type bytes.
+    return strcmp(*(char* const*)a + 1, *(char* const*)b + 1);
+}
+
+// Lists the entries of the directory `dir` (the current one if empty) that
+// `component` matches, or every entry if it is `**`, into `names` and returns
+// them sorted by name, or NULL if there are none or memory ran out. Names
+// starting with a dot only match components starting with one, and `.` and
+// `..` never do.
+static char** cmdapp_glob_list(const char* dir, const char* component,
+                               cmdapp_paths_t* names) {
+    DIR* stream = opendir(*dir ? dir : ".");
+    if (stream == NULL) {
+        return NULL;
+    }
+    const bool globstar = _is_globstar(component);
+    for (struct dirent* entry; (entry = readdir(stream)) != NULL; ) {
+        const char* name = entry->d_name;
+        if (name[0] == '.' && (globstar || name[1] == 0
+                               || (name[1] == '.' && name[2] == 0))) {
+            continue;
+        }
+        if (!globstar && fnmatch(component, name, FNM_PERIOD) != 0) {
+            continue;
+        }
+        bool is_dir = false;
+        #ifdef DT_DIR
+        if (entry->d_type != DT_UNKNOWN) {
+            is_dir = entry->d_type == DT_DIR;
+        } else
+        #endif
+        {
+            char* path = malloc(strlen(dir) + strlen(name) + 2);
+            struct stat info;
+            if (path != NULL) {
+                sprintf(path, "%s%s%s", dir, *dir ? "/" : "", name);
+                is_dir = lstat(path, &info) == 0 && S_ISDIR(info.st_mode);
+                free(path);
+            }
+        }
+        cmdapp_paths_add(names, is_dir ? 'd' : '-', "", name);
+    }
+    closedir(stream);
+    if (names->count == 0 || names->failed) {
+        return NULL;
+    }
+    char** sorted = malloc(names->count * sizeof(char*));
+    if (sorted == NULL) {
+        names->failed = true;
+        return NULL;
+    }
+    const char* read = names->data;
+    for (size_t i = 0; i < names->count; i++) {
+        sorted[i] = (char*)read;
+        read += strlen(read) + 1;
+    }
+    qsort(sorted, names->count, sizeof(char*), _compare_names);
+    return sorted;
+}
+
+// Appends to `out` every path matched by the components of the pattern from
+// `index` on, below the path `base`, which exists.
+static void cmdapp_glob_expand(const cmdapp_pattern_t* pattern,
+                               const char* base, size_t index,
+                               cmdapp_paths_t* out) {
+    if (index == pattern->count) {
+        cmdapp_paths_add(out, 0, base, "");
+        return;
+    }
+    const char* component = pattern->components[index];
+    const bool last = index + 1 == pattern->count;
+    if (!_is_magic(component)) {
+        // A literal component is not listed, only looked up at the end.
+        cmdapp_paths_t joined = { 0 };
+        cmdapp_paths_add(&joined, 0, base, component);
+        struct stat info;
+        if (joined.failed) {
+            out->failed = true;
+        } else if (!last || lstat(joined.data, &info) == 0) {
+            cmdapp_glob_expand(pattern, joined.data, index + 1, out);
+        }
+        free(joined.data);
+        return;
+    }
+    const bool globstar = _is_globstar(component);
+    if (globstar && !last) {
+        // `**` first stands for no directories at all.
+        cmdapp_glob_expand(pattern, base, index + 1, out);
+    }
+    cmdapp_paths_t names = { 0 };
+    char** sorted = cmdapp_glob_list(base, component, &names);
+    for (size_t i = 0; sorted != NULL && i < names.count; i++) {
+        const bool is_dir = sorted[i][0] == 'd';
+        const char* name = sorted[i] + 1;
+        cmdapp_paths_t joined = { 0 };
+        cmdapp_paths_add(&joined, 0, base, name);
+        if (joined.failed) {
+            out->failed = true;
+        } else if (!globstar) {
+            cmdapp_glob_expand(pattern, joined.data, index + 1, out);
+        } else {
+            // A final `**` matches everything below, a `**` followed by more
+            // components only directories, and neither follows links.
+            if (last) cmdapp_paths_add(out, 0, joined.data, "");
+            if (is_dir) cmdapp_glob_expand(pattern, joined.data, index, out);
+        }
+        free(joined.data);
+    }
+    out->failed |= names.failed;
+    free(sorted);
+    free(names.data);
+}
+
+// A subtree of the expansion: the matches below `base` from component
+// `index` on, after `base` itself if `self` is set.
+typedef struct {
+    const char* base;
+    size_t index;
+    bool self;
+} cmdapp_glob_task_t;
+
+typedef struct {
+    const cmdapp_pattern_t* pattern;
+    const cmdapp_glob_task_t* tasks;
+    cmdapp_paths_t* outs;
+} cmdapp_glob_batch_t;
+
+static bool cmdapp_glob_item(const void* data, size_t i) {
+    const cmdapp_glob_batch_t* batch = data;
+    const cmdapp_glob_task_t* task = &batch->tasks[i];
+    if (task->self) {
+        cmdapp_paths_add(&batch->outs[i], 0, task->base, "");
+    }
+    cmdapp_glob_expand(batch->pattern, task->base, task->index,
+                       &batch->outs[i]);
+    return !batch->outs[i].failed;
+}
+
+// Expands the tasks in windows of CMDAPP_GLOB_WINDOW on the pool, handing
+// each window's matches to `match` in order before starting the next.
+static int cmdapp_glob_run(const cmdapp_pattern_t* pattern,
+                           const cmdapp_glob_task_t* tasks, size_t count,
+                           size_t nthreads, cmdapp_match_t match,
+                           void* data) {
+    cmdapp_paths_t* outs = calloc(count < CMDAPP_GLOB_WINDOW
+                                  ? count : CMDAPP_GLOB_WINDOW,
+                                  sizeof(cmdapp_paths_t));
+    if (outs == NULL) {
+        return EXIT_FAILURE;
+    }
+    int status = EXIT_SUCCESS;
+    bool stopped = false;
+    for (size_t start = 0; start < count && !stopped
+                           && status == EXIT_SUCCESS;
+         start += CMDAPP_GLOB_WINDOW) {
+        const size_t n = count - start < CMDAPP_GLOB_WINDOW
+                         ? count - start : CMDAPP_GLOB_WINDOW;
+        const cmdapp_glob_batch_t batch = { pattern, tasks + start, outs };
+        if (cmdapp_for_each(cmdapp_glob_item, &batch, n, nthreads)) {
+            status = EXIT_FAILURE;
+        }
+        for (size_t t = 0; t < n; t++) {
+            const char* read = outs[t].data;
+            for (size_t k = 0; k < outs[t].count && !stopped
+                               && status == EXIT_SUCCESS; k++) {
+                const size_t length = strlen(read);
+                stopped = !match(data, read, length);
+                read += length + 1;
+            }
+            free(outs[t].data);
+            outs[t] = (cmdapp_paths_t){ 0 };
+        }
+    }
+    free(outs);
+    return status;
+}
+
+int cmdapp_glob(const char* pattern, size_t nthreads, cmdapp_match_t match,
+                void* data) {
+    const size_t length = strlen(pattern);
+    cmdapp_pattern_t split = { malloc(length + 1), NULL, 0 };
+    split.components = malloc((length / 2 + 1) * sizeof(char*));
+    if (split.copy == NULL || split.components == NULL) {
+        free(split.copy);
+        free(split.components);
+        return EXIT_FAILURE;
+    }
+    memcpy(split.copy, pattern, length + 1);
+    for (char* read = split.copy; *read; ) {
+        if (*read == '/') {
+            *read++ = 0;
+            continue;
+        }
+        split.components[split.count++] = read;
+        read += strcspn(read, "/");
+    }
+
+    // The components before the first wildcard name one directory, which is
+    // where the work is split: its matching entries are expanded in parallel.
+    char* base = malloc(length + 2);
+    size_t first = 0;
+    int status = EXIT_FAILURE;
+    if (base != NULL) {
+        strcpy(base, pattern[0] == '/' ? "/" : "");
+        for (; first < split.count && !_is_magic(split.components[first]);
+             first++) {
+            if (first && strcmp(base, "/") != 0) strcat(base, "/");
+            strcat(base, split.components[first]);
+        }
+    }
+    cmdapp_paths_t names = { 0 };
+    char** sorted = NULL;
+    cmdapp_glob_task_t* tasks = NULL;
+    size_t count = 0;
+    if (base != NULL && first < split.count) {
+        const char* component = split.components[first];
+        const bool globstar = _is_globstar(component);
+        const bool last = first + 1 == split.count;
+        sorted = cmdapp_glob_list(base, component, &names);
+        tasks = malloc((names.count + 1) * sizeof(cmdapp_glob_task_t));
+        if (tasks != NULL && (sorted != NULL || !names.failed)) {
+            cmdapp_paths_t paths = { 0 };
+            if (globstar && !last) {
+                tasks[count++] = (cmdapp_glob_task_t){ base, first + 1,
+                                                       false };
+            }
+            for (size_t i = 0; sorted != NULL && i < names.count; i++) {
+                cmdapp_paths_add(&paths, sorted[i][0], base, sorted[i] + 1);
+            }
+            const char* read = paths.data;
+            for (size_t i = 0; !paths.failed && i < paths.count; i++) {
+                const bool is_dir = read[0] == 'd';
+                if (!globstar) {
+                    tasks[count++] = (cmdapp_glob_task_t){ read + 1,
+                                                           first + 1,
+                                                           false };
+                } else if (last || is_dir) {
+                    tasks[count++] = (cmdapp_glob_task_t){
+                        read + 1, is_dir ? first : split.count,
+                        last && is_dir
+                    };
+                }
+                read += strlen(read) + 1;
+            }
+            if (!paths.failed) {
+                status = cmdapp_glob_run(&split, tasks, count, nthreads
+                                         ? nthreads : CMDAPP_GLOB_THREADS,
+                                         match, data);
+            }
+            free(paths.data);
+        }
+    } else if (base != NULL) {
+        // Nothing to expand: the pattern matches itself if it exists.
+        struct stat info;
+        status = EXIT_SUCCESS;
+        if (lstat(pattern, &info) == 0) match(data, pattern, length);
+    }
+    free(tasks);
+    free(sorted);
+    free(names.data);
+    free(base);
+    free(split.copy);
+    free(split.components);
+    return status;
+}
+
+#else
+
+int cmdapp_glob(const char* pattern, size_t nthreads, cmdapp_match_t match,
+                void* data) {
+    // Without a directory interface, patterns match nothing.
+    (void)pattern;
+    (void)nthreads;
+    (void)match;
+    (void)data;
+    return EXIT_SUCCESS;
+}
+
+#endif /* _POSIX_VERSION */
@@ -0,0 +1,350 @@
+// cmdapp: cmdapp_getopt.c
+// Copyright (C) 2021 Ethan Uppal
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "cmdapp.h"
+#include "cmdapp_getopt.h"
+#include <stdio.h>
+#include <string.h>
+
+// How many (optstring, longopts) pairs are kept at once. Programs rarely use
+// more than one.
+#define CMDAPP_GETOPT_CACHE 4
+
+// What a short option character takes, from its suffix in optstring.
+enum {
+    SHORT_UNKNOWN,
+    SHORT_NO_ARG,
+    SHORT_REQUIRED,
+    SHORT_OPTIONAL
+};
+
+typedef enum {
+    ORDER_PERMUTE,
+    ORDER_REQUIRE,
+    ORDER_RETURN
+} cmdapp_order_t;
+
+// Everything derived from one optstring and longopts array.
+typedef struct {
+    const char* optstring;
+    const struct option* longopts;
+    bool used;
+    bool colon;
+    cmdapp_order_t order;
+    uint8_t shorts[256];
+    // The long options registered in an app only to look them up
+    cmdapp_t app;
+    cmdopt_t* options;
+    const cmdapp_spec_t* spec;
+} cmdapp_getopt_table_t;
+
+static cmdapp_getopt_table_t _tables[CMDAPP_GETOPT_CACHE];
+static size_t _next_victim;
+
+// Scanning state between calls, as in the GNU implementation: the rest of the
+// current bundle of short options, and the operands skipped so far, which sit
+// at [first_nonopt, last_nonopt) until they are moved behind the options.
+static struct {
+    char* const* argv;
+    const char* nextchar;
+    int first_nonopt;
+    int last_nonopt;
+    bool posixly_correct;
+} _state;
+
+static const cmdapp_info_t _info = { .program = "getopt", .description = "" };
+
+static void cmdapp_getopt_drop(cmdapp_getopt_table_t* table) {
+    if (table->used && table->options != NULL) {
+        cmdapp_destroy(&table->app);
+        free(table->options);
+    }
+    table->used = false;
+}
+
+void cmdapp_getopt_release(void) {
+    for (size_t i = 0; i < CMDAPP_GETOPT_CACHE; i++) {
+        cmdapp_getopt_drop(&_tables[i]);
+    }
+}
+
+// Returns the cached table for the pair, building it on first use, or NULL if
+// out of memory.
+static cmdapp_getopt_table_t* cmdapp_getopt_table(
+    const char* optstring, const struct option* longopts) {
+    for (size_t i = 0; i < CMDAPP_GETOPT_CACHE; i++) {
+        if (_tables[i].used && _tables[i].optstring == optstring
+            && _tables[i].longopts == longopts) {
+            return &_tables[i];
+        }
+    }
+    cmdapp_getopt_table_t* table = &_tables[_next_victim];
+    _next_victim = (_next_victim + 1) % CMDAPP_GETOPT_CACHE;
+    cmdapp_getopt_drop(table);
+
+    table->optstring = optstring;
+    table->longopts = longopts;
+    table->order = ORDER_PERMUTE;
+    table->colon = false;
+    table->options = NULL;
+    table->spec = NULL;
+    if (*optstring == '+' || *optstring == '-') {
+        table->order = *optstring == '+' ? ORDER_REQUIRE : ORDER_RETURN;
+        optstring++;
+    }
+    if (*optstring == ':') {
+        table->colon = true;
+        optstring++;
+    }
+    memset(table->shorts, SHORT_UNKNOWN, sizeof(table->shorts));
+    for (const char* p = optstring; *p; p++) {
+        if (*p == ':') continue;
+        uint8_t kind = SHORT_NO_ARG;
+        if (p[1] == ':') {
+            kind = p[2] == ':' ? SHORT_OPTIONAL : SHORT_REQUIRED;
+        }
+        table->shorts[(unsigned char)*p] = kind;
+    }
+
+    if (longopts != NULL) {
+        size_t count = 0;
+        while (longopts[count].name != NULL) count++;
+        table->options = malloc((count ? count : 1) * sizeof(cmdopt_t));
+        if (table->options == NULL) {
+            return NULL;
+        }
+        cmdapp_init(&table->app, 0, NULL, CMDAPP_MODE_ABBREV, &_info);
+        for (size_t i = 0; i < count; i++) {
+            cmdapp_set(&table->app, 0, longopts[i].name, CMDOPT_OPTIONAL,
+                       NULL, "", &table->options[i]);
+        }
+        table->spec = cmdapp_get_spec(&table->app);
+        if (table->spec == NULL) {
+            cmdapp_destroy(&table->app);
+            free(table->options);
+            return NULL;
+        }
+    }
+    table->used = true;
+    return table;
+}
+
+static inline bool _is_operand(const char* arg) {
+    return arg[0] != '-' || arg[1] == 0;
+}
+
+// Moves the skipped operands [first_nonopt, last_nonopt) behind the options
+// [last_nonopt, optind) that followed them, keeping both in order.
+static void cmdapp_getopt_exchange(char* const* argv) {
+    char** args = (char**)argv;
+    int bottom = _state.first_nonopt;
+    int middle = _state.last_nonopt;
+    int top = optind;
+    while (top > middle && middle > bottom) {
+        if (top - middle > middle - bottom) {
+            // Swap the operands with the top of the options.
+            const int length = middle - bottom;
+            for (int i = 0; i < length; i++) {
+                char* tmp = args[bottom + i];
+                args[bottom + i] = args[top - length + i];
+                args[top - length + i] = tmp;
+            }
+            top -= length;
+        } else {
+            // Swap the options with the bottom of the operands.
+            const int length = top - middle;
+            for (int i = 0; i < length; i++) {
+                char* tmp = args[bottom + i];
+                args[bottom + i] = args[middle + i];
+                args[middle + i] = tmp;
+            }
+            bottom += length;
+        }
+    }
+    _state.first_nonopt += optind - _state.last_nonopt;
+    _state.last_nonopt = optind;
+}
+
+static int cmdapp_getopt_long_option(const cmdapp_getopt_table_t* table,
+                                     int argc, char* const argv[],
+                                     int* longindex) {
+    const char* current = argv[optind];
+    const char* name = current + 2;
+    const char* arg = strchr(name, '=');
+    const size_t length = arg ? (size_t)(arg - name) : strlen(name);
+    const bool print = opterr && !table->colon;
+    optind++;
+
+    size_t id;
+    const cmdapp_errcode_t code = cmdapp_find_long(table->spec, name, length,
+                                                   &id);
+    if (code != CMDAPP_OK) {
+        if (print) {
+            fprintf(stderr, code == CMDAPP_ERR_AMBIGUOUS
+                            ? "%s: option '%s' is ambiguous\n"
+                            : "%s: unrecognized option '%s'\n",
+                    argv[0], current);
+        }
+        optopt = 0;
+        return '?';
+    }
+    const struct option* option = &table->longopts[id];
+    optarg = NULL;
+    if (arg != NULL) {
+        if (option->has_arg == no_argument) {
+            if (print) {
+                fprintf(stderr, "%s: option '--%s' doesn't allow an "
+                        "argument\n", argv[0], option->name);
+            }
+            optopt = option->val;
+            return '?';
+        }
+        optarg = (char*)arg + 1;
+    } else if (option->has_arg == required_argument) {
+        if (optind >= argc) {
+            if (print) {
+                fprintf(stderr, "%s: option '--%s' requires an argument\n",
+                        argv[0], option->name);
+            }
+            optopt = option->val;
+            return table->colon ? ':' : '?';
+        }
+        optarg = argv[optind++];
+    }
+    if (longindex != NULL) {
+        *longindex = (int)id;
+    }
+    if (option->flag != NULL) {
+        *option->flag = option->val;
+        return 0;
+    }
+    return option->val;
+}
+
+static int cmdapp_getopt_short_option(const cmdapp_getopt_table_t* table,
+                                      int argc, char* const argv[]) {
+    const char c = *_state.nextchar++;
+    const uint8_t kind = table->shorts[(unsigned char)c];
+    if (*_state.nextchar == 0) {
+        optind++;
+    }
+    optarg = NULL;
+    if (kind == SHORT_UNKNOWN) {
+        if (opterr && !table->colon) {
+            fprintf(stderr, "%s: invalid option -- '%c'\n", argv[0], c);
+        }
+        optopt = (unsigned char)c;
+        return '?';
+    }
+    if (kind == SHORT_NO_ARG) {
+        return c;
+    }
+    if (*_state.nextchar) {
+        // The rest of the bundle is the argument.
+        optarg = (char*)_state.nextchar;
+        optind++;
+    } else if (kind == SHORT_REQUIRED) {
+        if (optind >= argc) {
+            if (opterr && !table->colon) {
+                fprintf(stderr, "%s: option requires an argument -- '%c'\n",
+                        argv[0], c);
+            }
+            optopt = (unsigned char)c;
+            _state.nextchar = NULL;
+            return table->colon ? ':' : '?';
+        }
+        optarg = argv[optind++];
+    }
+    _state.nextchar = NULL;
+    return c;
+}
+
+int cmdapp_getopt_long(int argc, char* const argv[], const char* optstring,
+                       const struct option* longopts, int* longindex) {
+    const cmdapp_getopt_table_t* table = cmdapp_getopt_table(optstring,
+                                                             longopts);
+    if (table == NULL) {
+        return -1;
+    }
+    if (optind == 0 || argv != _state.argv) {
+        // A fresh scan.
+        if (optind == 0) optind = 1;
+        _state.argv = argv;
+        _state.nextchar = NULL;
+        _state.first_nonopt = _state.last_nonopt = optind;
+        _state.posixly_correct = getenv("POSIXLY_CORRECT") != NULL;
+    }
+    optarg = NULL;
+    if (_state.nextchar != NULL && *_state.nextchar) {
+        return cmdapp_getopt_short_option(table, argc, argv);
+    }
+
+    cmdapp_order_t order = table->order;
+    if (order == ORDER_PERMUTE && _state.posixly_correct) {
+        order = ORDER_REQUIRE;
+    }
+    // The caller may have moved optind.
+    if (_state.last_nonopt > optind) _state.last_nonopt = optind;
+    if (_state.first_nonopt > optind) _state.first_nonopt = optind;
+
+    if (order == ORDER_PERMUTE) {
+        if (_state.first_nonopt != _state.last_nonopt
+            && _state.last_nonopt != optind) {
+            cmdapp_getopt_exchange(argv);
+        } else if (_state.last_nonopt != optind) {
+            _state.first_nonopt = optind;
+        }
+        while (optind < argc && _is_operand(argv[optind])) {
+            optind++;
+        }
+        _state.last_nonopt = optind;
+    }
+    if (optind < argc && strcmp(argv[optind], "--") == 0) {
+        // Everything after `--` is an operand.
+        optind++;
+        if (_state.first_nonopt != _state.last_nonopt
+            && _state.last_nonopt != optind) {
+            cmdapp_getopt_exchange(argv);
+        } else if (_state.first_nonopt == _state.last_nonopt) {
+            _state.first_nonopt = optind;
+        }
+        _state.last_nonopt = argc;
+        optind = argc;
+    }
+    if (optind >= argc) {
+        // Leave optind at the first operand.
+        if (_state.first_nonopt != _state.last_nonopt) {
+            optind = _state.first_nonopt;
+        }
+        return -1;
+    }
+    if (_is_operand(argv[optind])) {
+        if (order == ORDER_REQUIRE) {
+            return -1;
+        }
+        optarg = argv[optind++];
+        return 1;
+    }
+    if (longopts != NULL && argv[optind][1] == '-') {
+        return cmdapp_getopt_long_option(table, argc, argv, longindex);
+    }
+    _state.nextchar = argv[optind] + 1;
+    return cmdapp_getopt_short_option(table, argc, argv);
+}
+
+int cmdapp_getopt(int argc, char* const argv[], const char* optstring) {
+    return cmdapp_getopt_long(argc, argv, optstring, NULL, NULL);
+}
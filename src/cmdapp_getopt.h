@@ -0,0 +1,53 @@
+// cmdapp: cmdapp_getopt.h
+// Copyright (C) 2021 Ethan Uppal
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef _CMDAPP_GETOPT_H
+#define _CMDAPP_GETOPT_H
+
+#include "cmdapp.h"
+#include <getopt.h>
+
+// Drop-in replacements for getopt and getopt_long that share optind, optarg,
+// opterr and optopt with the C library and follow the GNU conventions:
+// arguments are permuted so that options come first unless `optstring`
+// starts with `+` or POSIXLY_CORRECT is set, a leading `-` returns operands
+// as the argument of option 1, a leading `:` returns `:` for missing
+// arguments and silences the messages, and long options may be abbreviated.
+// Setting optind to zero restarts scanning.
+//
+// The long options are registered in a cmdapp table the first time a
+// `longopts` array is seen and the table is kept for later calls, so each
+// option costs a hash lookup rather than a scan of `longopts`. The array must
+// therefore not change while it is in use; call cmdapp_getopt_release after
+// changing or freeing one.
+CMDAPP_EXPORT int cmdapp_getopt(int argc, char* const argv[],
+                                const char* optstring);
+CMDAPP_EXPORT int cmdapp_getopt_long(int argc, char* const argv[],
+                                     const char* optstring,
+                                     const struct option* longopts,
+                                     int* longindex);
+
+// Frees the tables cached by cmdapp_getopt_long.
+CMDAPP_EXPORT void cmdapp_getopt_release(void);
+
+// Define CMDAPP_GETOPT_REPLACE before including this header to route
+// existing getopt and getopt_long calls through cmdapp.
+#ifdef CMDAPP_GETOPT_REPLACE
+#define getopt cmdapp_getopt
+#define getopt_long cmdapp_getopt_long
+#endif
+
+#endif /* _CMDAPP_GETOPT_H */
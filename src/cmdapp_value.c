@@ -0,0 +1,320 @@
+// cmdapp: cmdapp_value.c
+// Copyright (C) 2021 Ethan Uppal
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "cmdapp.h"
+#include <string.h>
+
+// The parsers below only ever look at ASCII, so unlike strtol and strtod they
+// behave the same in every locale and never touch it.
+
+static inline bool _isdigit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+static inline char _tolower(char c) {
+    return (c >= 'A' && c <= 'Z') ? (char)(c - 'A' + 'a') : c;
+}
+
+// Compares ASCII case-insensitively with a lowercase word.
+static bool _is_word(const char* str, size_t length, const char* word) {
+    for (size_t i = 0; i < length; i++) {
+        if (word[i] == 0 || _tolower(str[i]) != word[i]) {
+            return false;
+        }
+    }
+    return word[length] == 0;
+}
+
+// Reads decimal digits at `*str`, advancing past them. Fails when there are
+// none or they overflow.
+static cmdapp_errcode_t cmdapp_read_digits(const char** str, uint64_t* out) {
+    const char* p = *str;
+    if (!_isdigit(*p)) {
+        return CMDAPP_ERR_INVALID;
+    }
+    uint64_t value = 0;
+    bool overflow = false;
+    for (; _isdigit(*p); p++) {
+        const uint64_t digit = (uint64_t)(*p - '0');
+        if (value > (UINT64_MAX - digit) / 10) {
+            overflow = true;
+        }
+        value = value * 10 + digit;
+    }
+    *str = p;
+    *out = value;
+    return overflow ? CMDAPP_ERR_RANGE : CMDAPP_OK;
+}
+
+// Reads the digits after a decimal point as numerator / denominator, keeping
+// as many as fit.
+static void cmdapp_read_fraction(const char** str, uint64_t* numerator,
+                                 uint64_t* denominator) {
+    const char* p = *str;
+    *numerator = 0;
+    *denominator = 1;
+    for (; _isdigit(*p); p++) {
+        if (*denominator <= UINT64_MAX / 10 / 10) {
+            *numerator = *numerator * 10 + (uint64_t)(*p - '0');
+            *denominator *= 10;
+        }
+    }
+    *str = p;
+}
+
+static cmdapp_errcode_t cmdapp_to_int(const char* str, int64_t* out) {
+    const bool negative = *str == '-';
+    if (*str == '-' || *str == '+') str++;
+    uint64_t magnitude;
+    cmdapp_errcode_t code = cmdapp_read_digits(&str, &magnitude);
+    if (code == CMDAPP_OK && *str) {
+        return CMDAPP_ERR_INVALID;
+    }
+    if (code != CMDAPP_OK) {
+        return code;
+    }
+    if (magnitude > (uint64_t)INT64_MAX + negative) {
+        return CMDAPP_ERR_RANGE;
+    }
+    *out = negative ? (int64_t)(0 - magnitude) : (int64_t)magnitude;
+    return CMDAPP_OK;
+}
+
+static cmdapp_errcode_t cmdapp_to_uint(const char* str, uint64_t* out) {
+    if (*str == '+') str++;
+    cmdapp_errcode_t code = cmdapp_read_digits(&str, out);
+    return (code == CMDAPP_OK && *str) ? CMDAPP_ERR_INVALID : code;
+}
+
+// Powers of ten that doubles represent exactly.
+static const double _exact_pow10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12,
+    1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+// Gathers up to 19 significant digits and a decimal exponent. When both the
+// digits and the power of ten are exact in a double, one multiplication or
+// division gives the correctly rounded result. Otherwise the scaling is done
+// in long double, which can be off by one in the last place in rare cases.
+static cmdapp_errcode_t cmdapp_to_double(const char* str, double* out) {
+    const bool negative = *str == '-';
+    if (*str == '-' || *str == '+') str++;
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int exponent = 0;
+    bool any = false;
+    bool truncated = false;
+    for (; _isdigit(*str); str++, any = true) {
+        if (digits < 19) {
+            mantissa = mantissa * 10 + (uint64_t)(*str - '0');
+            digits += mantissa != 0;
+        } else {
+            exponent++;
+            truncated |= *str != '0';
+        }
+    }
+    if (*str == '.') {
+        for (str++; _isdigit(*str); str++, any = true) {
+            if (digits < 19) {
+                mantissa = mantissa * 10 + (uint64_t)(*str - '0');
+                digits += mantissa != 0;
+                exponent--;
+            } else {
+                truncated |= *str != '0';
+            }
+        }
+    }
+    if (!any) {
+        return CMDAPP_ERR_INVALID;
+    }
+    if (*str == 'e' || *str == 'E') {
+        str++;
+        const bool exp_negative = *str == '-';
+        if (*str == '-' || *str == '+') str++;
+        if (!_isdigit(*str)) {
+            return CMDAPP_ERR_INVALID;
+        }
+        int written = 0;
+        for (; _isdigit(*str); str++) {
+            if (written < 100000) {
+                written = written * 10 + (*str - '0');
+            }
+        }
+        exponent += exp_negative ? -written : written;
+    }
+    if (*str) {
+        return CMDAPP_ERR_INVALID;
+    }
+
+    double value;
+    if (mantissa == 0) {
+        value = 0;
+    } else if (!truncated && mantissa <= ((uint64_t)1 << 53)
+               && exponent >= -22 && exponent <= 22) {
+        value = exponent < 0 ? (double)mantissa / _exact_pow10[-exponent]
+                             : (double)mantissa * _exact_pow10[exponent];
+    } else {
+        // Powers up to 10^27 are exact in the 64 bit significand of an x87
+        // long double, so a single rounding step remains.
+        long double power = 1;
+        long double base = 10;
+        for (int e = exponent < 0 ? -exponent : exponent; e; e >>= 1) {
+            if (e & 1) power *= base;
+            base *= base;
+        }
+        const long double scaled = (long double)mantissa;
+        value = (double)(exponent < 0 ? scaled / power : scaled * power);
+        if (value - value != 0) {
+            return CMDAPP_ERR_RANGE;
+        }
+    }
+    *out = negative ? -value : value;
+    return CMDAPP_OK;
+}
+
+static cmdapp_errcode_t cmdapp_to_bool(const char* str, bool* out) {
+    const size_t length = strlen(str);
+    if (_is_word(str, length, "true") || _is_word(str, length, "yes")
+        || _is_word(str, length, "on") || _is_word(str, length, "1")) {
+        *out = true;
+    } else if (_is_word(str, length, "false") || _is_word(str, length, "no")
+               || _is_word(str, length, "off") || _is_word(str, length, "0")) {
+        *out = false;
+    } else {
+        return CMDAPP_ERR_INVALID;
+    }
+    return CMDAPP_OK;
+}
+
+// Adds count * unit (plus the fraction of a unit) to `*total`, failing on
+// overflow.
+static cmdapp_errcode_t cmdapp_accumulate(uint64_t* total, uint64_t count,
+                                          uint64_t numerator,
+                                          uint64_t denominator,
+                                          uint64_t unit) {
+    if (count > UINT64_MAX / unit) {
+        return CMDAPP_ERR_RANGE;
+    }
+    const uint64_t whole = count * unit;
+    const uint64_t part = (uint64_t)((long double)numerator / denominator
+                                     * unit);
+    if (whole > UINT64_MAX - part || *total > UINT64_MAX - whole - part) {
+        return CMDAPP_ERR_RANGE;
+    }
+    *total += whole + part;
+    return CMDAPP_OK;
+}
+
+static cmdapp_errcode_t cmdapp_to_size(const char* str, uint64_t* out) {
+    uint64_t count;
+    cmdapp_errcode_t code = cmdapp_read_digits(&str, &count);
+    if (code != CMDAPP_OK) {
+        return code;
+    }
+    uint64_t numerator = 0;
+    uint64_t denominator = 1;
+    const bool fraction = *str == '.';
+    if (fraction) {
+        str++;
+        cmdapp_read_fraction(&str, &numerator, &denominator);
+    }
+    static const char units[] = "kmgtpe";
+    int shift = 0;
+    for (int i = 0; units[i]; i++) {
+        if (_tolower(*str) == units[i]) {
+            shift = 10 * (i + 1);
+            str++;
+            if (*str == 'i') str++;
+            break;
+        }
+    }
+    if (*str == 'B' || *str == 'b') str++;
+    // A fraction of a byte makes no sense.
+    if (*str || (fraction && shift == 0)) {
+        return CMDAPP_ERR_INVALID;
+    }
+    *out = 0;
+    return cmdapp_accumulate(out, count, numerator, denominator,
+                             (uint64_t)1 << shift);
+}
+
+static cmdapp_errcode_t cmdapp_to_duration(const char* str, uint64_t* out) {
+    static const struct {
+        const char* name;
+        uint64_t ns;
+    } units[] = {
+        // Longer names first, so that `ms` is not taken for `m`.
+        { "ns", 1 }, { "us", 1000 }, { "ms", 1000000 },
+        { "s", 1000000000 }, { "m", 60000000000 }, { "h", 3600000000000 },
+        { "d", 86400000000000 }
+    };
+    *out = 0;
+    bool first = true;
+    do {
+        uint64_t count;
+        cmdapp_errcode_t code = cmdapp_read_digits(&str, &count);
+        if (code != CMDAPP_OK) {
+            return code;
+        }
+        uint64_t numerator = 0;
+        uint64_t denominator = 1;
+        if (*str == '.') {
+            str++;
+            cmdapp_read_fraction(&str, &numerator, &denominator);
+        }
+        uint64_t unit = 0;
+        if (first && *str == 0) {
+            // A bare number is in seconds.
+            unit = 1000000000;
+        }
+        for (size_t i = 0; !unit && i < sizeof(units) / sizeof(*units); i++) {
+            const size_t length = strlen(units[i].name);
+            if (strncmp(str, units[i].name, length) == 0) {
+                unit = units[i].ns;
+                str += length;
+            }
+        }
+        if (unit == 0) {
+            return CMDAPP_ERR_INVALID;
+        }
+        code = cmdapp_accumulate(out, count, numerator, denominator, unit);
+        if (code != CMDAPP_OK) {
+            return code;
+        }
+        first = false;
+    } while (*str);
+    return CMDAPP_OK;
+}
+
+cmdapp_errcode_t cmdapp_convert(const char* str, cmdopt_flags_t type,
+                                cmdopt_value_t* value) {
+    switch (type & CMDOPT_TYPE_MASK) {
+        case CMDOPT_INT:
+            return cmdapp_to_int(str, &value->i);
+        case CMDOPT_UINT:
+            return cmdapp_to_uint(str, &value->u);
+        case CMDOPT_DOUBLE:
+            return cmdapp_to_double(str, &value->d);
+        case CMDOPT_BOOL:
+            return cmdapp_to_bool(str, &value->b);
+        case CMDOPT_SIZE:
+            return cmdapp_to_size(str, &value->u);
+        case CMDOPT_DURATION:
+            return cmdapp_to_duration(str, &value->u);
+        default:
+            return CMDAPP_ERR_INVALID;
+    }
+}
@@ -0,0 +1,568 @@
+// cmdapp: cmdapp_gen.c
+// Copyright (C) 2021 Ethan Uppal
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+// Turns a declarative option spec into a header holding a cmdapp_table_t for
+// cmdapp_init_static, together with a long option lookup specialised for the
+// spec, its conflict masks and its --help text. The masks and help come from
+// the library itself, so they always match what cmdapp_run would compute.
+//
+// The spec has one directive per line, with `#` comments and words that may
+// be double-quoted:
+//
+//   prefix NAME                C prefix of the generated names
+//   program NAME               Program name shown in --help
+//   description "TEXT"         Description shown in --help
+//   synopsis "TEXT"            A usage line, repeatable
+//   offset N                   help_des_offset
+//   option S LONG FLAGS [conflicts=LONG,...] [env=VAR] "DESCRIPTION"
+//
+// S is the short name or `-` for none, LONG is the long name or `-`, and
+// FLAGS is a `|`-separated list of CMDOPT_ flags without the prefix, or `-`.
+// As with cmdapp_set, a type implies TAKESARG, or MAYTAKEARG for BOOL. Each
+// option must map to its own PREFIX_NAME identifier.
+
+#include "cmdapp.h"
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+
+#define MAX_WORDS 16
+#define MAX_SYNOPSES 16
+
+typedef struct {
+    char shorto;
+    char* longo;
+    cmdopt_flags_t flags;
+    char* flag_names;
+    char* conflicts;
+    char* env;
+    char* description;
+    char* name;
+    // The spec line the option is declared on
+    size_t line;
+} gen_option_t;
+
+typedef struct {
+    char* prefix;
+    char* program;
+    char* description;
+    char* synopses[MAX_SYNOPSES + 1];
+    size_t synopsis_count;
+    int offset;
+    gen_option_t* options;
+    size_t length;
+    size_t capacity;
+} gen_spec_t;
+
+static const struct {
+    const char* name;
+    cmdopt_flags_t value;
+} gen_flags[] = {
+    { "OPTIONAL", CMDOPT_OPTIONAL }, { "TAKESARG", CMDOPT_TAKESARG },
+    { "MAYTAKEARG", CMDOPT_MAYTAKEARG }, { "INT", CMDOPT_INT },
+    { "UINT", CMDOPT_UINT }, { "DOUBLE", CMDOPT_DOUBLE },
+    { "BOOL", CMDOPT_BOOL }, { "SIZE", CMDOPT_SIZE },
+    { "DURATION", CMDOPT_DURATION }, { "MULTI", CMDOPT_MULTI },
+    { "SPLIT", CMDOPT_SPLIT }
+};
+
+static const char* gen_path;
+static size_t gen_line;
+
+static void gen_fail(const char* message, const char* detail) {
+    fprintf(stderr, "%s:%zu: %s%s%s\n", gen_path, gen_line, message,
+            detail ? ": " : "", detail ? detail : "");
+    exit(EXIT_FAILURE);
+}
+
+static void* gen_alloc(size_t size) {
+    void* ptr = calloc(1, size ? size : 1);
+    if (ptr == NULL) {
+        fprintf(stderr, "cmdapp-gen: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    return ptr;
+}
+
+static char* gen_strdup(const char* str) {
+    char* copy = gen_alloc(strlen(str) + 1);
+    strcpy(copy, str);
+    return copy;
+}
+
+// Splits a line into words in place, unquoting and unescaping quoted ones.
+static size_t gen_split(char* line, char** words) {
+    size_t count = 0;
+    char* p = line;
+    for (;;) {
+        while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') p++;
+        if (*p == 0 || *p == '#') break;
+        if (count == MAX_WORDS) gen_fail("too many words", NULL);
+        char* out = p;
+        words[count++] = out;
+        bool quoted = false;
+        for (; *p; p++) {
+            if (*p == '"') {
+                quoted = !quoted;
+            } else if (quoted && *p == '\\' && p[1]) {
+                p++;
+                *out++ = *p == 'n' ? '\n' : *p;
+            } else if (!quoted && (*p == ' ' || *p == '\t' || *p == '\r'
+                                   || *p == '\n')) {
+                break;
+            } else {
+                *out++ = *p;
+            }
+        }
+        if (quoted) gen_fail("unterminated quote", NULL);
+        if (*p) p++;
+        *out = 0;
+    }
+    return count;
+}
+
+static cmdopt_flags_t gen_parse_flags(const char* names) {
+    cmdopt_flags_t flags = 0;
+    if (strcmp(names, "-") == 0) {
+        return flags;
+    }
+    for (const char* p = names; *p; ) {
+        const size_t length = strcspn(p, "|");
+        size_t i = 0;
+        for (; i < sizeof(gen_flags) / sizeof(*gen_flags); i++) {
+            if (strlen(gen_flags[i].name) == length
+                && strncmp(gen_flags[i].name, p, length) == 0) {
+                flags |= gen_flags[i].value;
+                break;
+            }
+        }
+        if (i == sizeof(gen_flags) / sizeof(*gen_flags)) {
+            gen_fail("unknown flag", p);
+        }
+        p += length;
+        if (*p) p++;
+    }
+    return flags;
+}
+
+// PREFIX_LONG, upper-cased, with anything but letters and digits as `_`.
+static char* gen_identifier(const char* prefix, const char* name) {
+    char* identifier = gen_alloc(strlen(prefix) + strlen(name) + 2);
+    char* out = identifier;
+    for (const char* p = prefix; *p; p++) *out++ = (char)toupper(*p);
+    *out++ = '_';
+    for (const char* p = name; *p; p++) {
+        *out++ = isalnum((unsigned char)*p) ? (char)toupper(*p) : '_';
+    }
+    return identifier;
+}
+
+static void gen_read(gen_spec_t* spec, FILE* file) {
+    char line[4096];
+    while (fgets(line, sizeof(line), file)) {
+        gen_line++;
+        char* words[MAX_WORDS];
+        const size_t count = gen_split(line, words);
+        if (count == 0) continue;
+        const char* directive = words[0];
+        if (strcmp(directive, "option") == 0) {
+            if (count < 5) gen_fail("option needs S LONG FLAGS DESC", NULL);
+            if (spec->length == spec->capacity) {
+                spec->capacity = spec->capacity ? spec->capacity * 2 : 16;
+                gen_option_t* options = gen_alloc(spec->capacity
+                                                  * sizeof(gen_option_t));
+                if (spec->length) {
+                    memcpy(options, spec->options,
+                           spec->length * sizeof(gen_option_t));
+                }
+                free(spec->options);
+                spec->options = options;
+            }
+            gen_option_t* option = &spec->options[spec->length++];
+            memset(option, 0, sizeof(*option));
+            if (strcmp(words[1], "-") != 0) {
+                if (strlen(words[1]) != 1) {
+                    gen_fail("bad short name", words[1]);
+                }
+                option->shorto = words[1][0];
+            }
+            if (strcmp(words[2], "-") != 0) {
+                option->longo = gen_strdup(words[2]);
+            }
+            if (!option->shorto && !option->longo) {
+                gen_fail("option without a name", NULL);
+            }
+            option->line = gen_line;
+            option->flags = gen_parse_flags(words[3]);
+            option->flag_names = gen_strdup(words[3]);
+            const cmdopt_flags_t implied = cmdopt_implied_flags(option->flags);
+            if ((implied & CMDOPT_TAKESARG) && (implied & CMDOPT_MAYTAKEARG)) {
+                gen_fail("TAKESARG and MAYTAKEARG exclude each other",
+                         words[3]);
+            }
+            if ((option->flags & CMDOPT_SPLIT) == CMDOPT_SPLIT
+                && !(implied & (CMDOPT_TAKESARG | CMDOPT_MAYTAKEARG))) {
+                gen_fail("SPLIT needs an argument to split", words[3]);
+            }
+            for (size_t i = 4; i + 1 < count; i++) {
+                if (strncmp(words[i], "conflicts=", 10) == 0) {
+                    option->conflicts = gen_strdup(words[i] + 10);
+                } else if (strncmp(words[i], "env=", 4) == 0) {
+                    option->env = gen_strdup(words[i] + 4);
+                } else {
+                    gen_fail("unknown attribute", words[i]);
+                }
+            }
+            option->description = gen_strdup(words[count - 1]);
+        } else if (count != 2) {
+            gen_fail("expected one value", directive);
+        } else if (strcmp(directive, "prefix") == 0) {
+            spec->prefix = gen_strdup(words[1]);
+        } else if (strcmp(directive, "program") == 0) {
+            spec->program = gen_strdup(words[1]);
+        } else if (strcmp(directive, "description") == 0) {
+            spec->description = gen_strdup(words[1]);
+        } else if (strcmp(directive, "synopsis") == 0) {
+            if (spec->synopsis_count == MAX_SYNOPSES) {
+                gen_fail("too many synopses", NULL);
+            }
+            spec->synopses[spec->synopsis_count++] = gen_strdup(words[1]);
+        } else if (strcmp(directive, "offset") == 0) {
+            spec->offset = atoi(words[1]);
+        } else {
+            gen_fail("unknown directive", directive);
+        }
+    }
+    if (spec->prefix == NULL) gen_fail("missing prefix", NULL);
+    if (spec->program == NULL) spec->program = spec->prefix;
+    for (size_t i = 0; i < spec->length; i++) {
+        gen_option_t* option = &spec->options[i];
+        const char name[2] = { option->shorto, 0 };
+        option->name = gen_identifier(spec->prefix,
+                                      option->longo ? option->longo : name);
+        for (size_t j = 0; j < i; j++) {
+            if (strcmp(spec->options[j].name, option->name) == 0) {
+                char message[64];
+                snprintf(message, sizeof(message),
+                         "same identifier as the option on line %zu",
+                         spec->options[j].line);
+                gen_line = option->line;
+                gen_fail(message, option->name);
+            }
+        }
+    }
+}
+
+static size_t gen_find(const gen_spec_t* spec, const char* name,
+                       size_t length) {
+    for (size_t i = 0; i < spec->length; i++) {
+        const gen_option_t* option = &spec->options[i];
+        if (option->longo ? strlen(option->longo) == length
+                            && strncmp(option->longo, name, length) == 0
+                          : length == 1 && option->shorto == name[0]) {
+            return i;
+        }
+    }
+    fprintf(stderr, "%s: unknown conflicting option %.*s\n", gen_path,
+            (int)length, name);
+    exit(EXIT_FAILURE);
+}
+
+static void gen_string(FILE* out, const char* str) {
+    fputc('"', out);
+    for (const char* p = str; *p; p++) {
+        const unsigned char c = (unsigned char)*p;
+        if (c == '"' || c == '\\') {
+            fprintf(out, "\\%c", c);
+        } else if (c == '\n') {
+            // Break the literal at newlines so the help stays readable.
+            fputs(p[1] ? "\\n\"\n    \"" : "\\n", out);
+        } else if (c < 0x20 || c >= 0x7f) {
+            fprintf(out, "\\%03o", c);
+        } else {
+            fputc(c, out);
+        }
+    }
+    fputc('"', out);
+}
+
+static void gen_char(FILE* out, char c) {
+    if (c == '\'' || c == '\\') {
+        fprintf(out, "'\\%c'", c);
+    } else if (isprint((unsigned char)c)) {
+        fprintf(out, "'%c'", c);
+    } else {
+        fprintf(out, "%d", (unsigned char)c);
+    }
+}
+
+// Emits the long option lookup: a switch on the length, then a switch on the
+// byte position that best tells the names of that length apart, with a
+// single comparison confirming the match.
+static void gen_search(FILE* out, const gen_spec_t* spec) {
+    fprintf(out, "static uint32_t %s_search_long(const char* name, "
+            "size_t length) {\n", spec->prefix);
+    fprintf(out, "    switch (length) {\n");
+    size_t* group = gen_alloc(spec->length * sizeof(size_t));
+    bool* done = gen_alloc(spec->length * sizeof(bool));
+    for (size_t i = 0; i < spec->length; i++) {
+        if (!spec->options[i].longo || done[i]) continue;
+        // Gather the names of this length, keeping the first of duplicates.
+        const size_t length = strlen(spec->options[i].longo);
+        size_t count = 0;
+        for (size_t j = i; j < spec->length; j++) {
+            const char* longo = spec->options[j].longo;
+            if (!longo || done[j] || strlen(longo) != length) continue;
+            done[j] = true;
+            bool duplicate = false;
+            for (size_t k = 0; k < count; k++) {
+                duplicate |= strcmp(spec->options[group[k]].longo, longo) == 0;
+            }
+            if (!duplicate) group[count++] = j;
+        }
+        size_t position = 0;
+        size_t best = 0;
+        for (size_t p = 0; p < length; p++) {
+            size_t distinct = 0;
+            for (size_t k = 0; k < count; k++) {
+                bool seen = false;
+                for (size_t m = 0; m < k; m++) {
+                    seen |= spec->options[group[m]].longo[p]
+                            == spec->options[group[k]].longo[p];
+                }
+                distinct += !seen;
+            }
+            if (distinct > best) {
+                best = distinct;
+                position = p;
+            }
+        }
+        fprintf(out, "        case %zu:\n", length);
+        fprintf(out, "            switch (name[%zu]) {\n", position);
+        for (size_t k = 0; k < count; k++) {
+            const char c = spec->options[group[k]].longo[position];
+            bool first = true;
+            for (size_t m = 0; m < k; m++) {
+                first &= spec->options[group[m]].longo[position] != c;
+            }
+            if (!first) continue;
+            fprintf(out, "                case ");
+            gen_char(out, c);
+            fprintf(out, ":\n");
+            for (size_t m = k; m < count; m++) {
+                const gen_option_t* option = &spec->options[group[m]];
+                if (option->longo[position] != c) continue;
+                fprintf(out, "                    if (memcmp(name, ");
+                gen_string(out, option->longo);
+                fprintf(out, ", %zu) == 0) return %zu;\n", length,
+                        group[m] + 1);
+            }
+            fprintf(out, "                    return 0;\n");
+        }
+        fprintf(out, "            }\n");
+        fprintf(out, "            return 0;\n");
+    }
+    fprintf(out, "    }\n");
+    fprintf(out, "    (void)name;\n");
+    fprintf(out, "    return 0;\n");
+    fprintf(out, "}\n\n");
+    free(group);
+    free(done);
+}
+
+int main(int argc, char** argv) {
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s SPEC OUTPUT\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    gen_path = argv[1];
+    FILE* file = fopen(argv[1], "r");
+    if (file == NULL) {
+        perror(argv[1]);
+        return EXIT_FAILURE;
+    }
+    gen_spec_t spec = { 0 };
+    gen_read(&spec, file);
+    fclose(file);
+
+    // Register the spec with the library to get its masks and help.
+    cmdopt_t* results = gen_alloc((spec.length + 1) * sizeof(cmdopt_t));
+    cmdopt_t*** lists = gen_alloc((spec.length + 1) * sizeof(cmdopt_t**));
+    char* app_argv[] = { spec.program, NULL };
+    const cmdapp_info_t info = {
+        .program = spec.program,
+        .description = spec.description,
+        .synopses = spec.synopsis_count ? (const char**)spec.synopses : NULL,
+        .help_des_offset = spec.offset
+    };
+    cmdapp_t app;
+    cmdapp_init(&app, 1, app_argv, CMDAPP_MODE_SILENT, &info);
+    size_t rows = 0;
+    for (size_t i = 0; i < spec.length; i++) {
+        gen_option_t* option = &spec.options[i];
+        cmdopt_t** list = NULL;
+        if (option->conflicts) {
+            list = gen_alloc((strlen(option->conflicts) + 2)
+                             * sizeof(cmdopt_t*));
+            size_t n = 0;
+            for (const char* p = option->conflicts; *p; ) {
+                const size_t length = strcspn(p, ",");
+                list[n++] = &results[gen_find(&spec, p, length)];
+                p += length;
+                if (*p) p++;
+            }
+            if (n) {
+                rows++;
+                lists[i] = list;
+            }
+        }
+        cmdapp_set(&app, option->shorto, option->longo, option->flags, list,
+                   option->description, &results[i]);
+        if (option->env) {
+            cmdapp_set_env(&app, &results[i], option->env);
+        }
+    }
+    const cmdapp_spec_t* built = cmdapp_get_spec(&app);
+    if (built == NULL) {
+        fprintf(stderr, "cmdapp-gen: out of memory\n");
+        return EXIT_FAILURE;
+    }
+    const size_t help_width = 80;
+    const size_t help_length = cmdapp_format_help(&app, NULL, 0, help_width);
+    char* help = gen_alloc(help_length + 1);
+    cmdapp_format_help(&app, help, help_length + 1, help_width);
+
+    FILE* out = fopen(argv[2], "w");
+    if (out == NULL) {
+        perror(argv[2]);
+        return EXIT_FAILURE;
+    }
+    const char* p = spec.prefix;
+    char* upper = gen_identifier(p, "COUNT");
+    fprintf(out, "// Generated by cmdapp-gen from %s. Do not edit.\n\n",
+            argv[1]);
+    fprintf(out, "// Pass %s_table to cmdapp_init_static together with %s_info"
+            "\n// or a copy of it.\n\n", p, p);
+    fprintf(out, "#include \"cmdapp.h\"\n#include <string.h>\n\n");
+
+    fprintf(out, "enum {\n");
+    for (size_t i = 0; i < spec.length; i++) {
+        fprintf(out, "    %s,\n", spec.options[i].name);
+    }
+    fprintf(out, "    %s\n};\n\n", upper);
+    fprintf(out, "static cmdopt_t %s_options[%s];\n\n", p, upper);
+
+    if (spec.synopsis_count) {
+        fprintf(out, "static const char* %s_synopses[] = {\n", p);
+        for (size_t i = 0; i < spec.synopsis_count; i++) {
+            fprintf(out, "    ");
+            gen_string(out, spec.synopses[i]);
+            fprintf(out, ",\n");
+        }
+        fprintf(out, "    NULL\n};\n\n");
+    }
+    fprintf(out, "static const cmdapp_info_t %s_info = {\n    .program = ", p);
+    gen_string(out, spec.program);
+    if (spec.description) {
+        fprintf(out, ",\n    .description = ");
+        gen_string(out, spec.description);
+    }
+    if (spec.synopsis_count) {
+        fprintf(out, ",\n    .synopses = %s_synopses", p);
+    }
+    fprintf(out, ",\n    .help_des_offset = %d\n};\n\n", spec.offset);
+
+    gen_search(out, &spec);
+
+    const size_t words = ((spec.length + 63) / 64) * (3 + rows);
+    fprintf(out, "static const uint64_t %s_masks[%zu] = {", p,
+            words ? words : 1);
+    for (size_t i = 0; i < words; i++) {
+        fprintf(out, "%s0x%016llxull,", i % 3 ? " " : "\n    ",
+                (unsigned long long)built->_index._masks[i]);
+    }
+    fprintf(out, "%s};\n\n", words ? "\n" : " 0 ");
+
+    fprintf(out, "static const cmdopt_desc_t %s_descs[] = {\n", p);
+    for (size_t i = 0; i < spec.length; i++) {
+        const gen_option_t* option = &spec.options[i];
+        fprintf(out, "    { .shorto = ");
+        gen_char(out, option->shorto);
+        fprintf(out, ", .longo = ");
+        if (option->longo) {
+            gen_string(out, option->longo);
+        } else {
+            fprintf(out, "NULL");
+        }
+        fprintf(out, ",\n      .flags = ");
+        if (option->flags == 0) {
+            fprintf(out, "0");
+        } else {
+            for (const char* f = option->flag_names; *f; ) {
+                const size_t length = strcspn(f, "|");
+                fprintf(out, "%sCMDOPT_%.*s", f == option->flag_names
+                        ? "" : " | ", (int)length, f);
+                f += length;
+                if (*f) f++;
+            }
+        }
+        fprintf(out, ",\n      .description = ");
+        gen_string(out, option->description);
+        if (lists[i]) {
+            fprintf(out, ",\n      .conflicts = CMDAPP_CONFLICTS(");
+            cmdopt_t** list = lists[i];
+            for (size_t n = 0; list[n]; n++) {
+                fprintf(out, "%s&%s_options[%s]", n ? ", " : "", p,
+                        spec.options[list[n] - results].name);
+            }
+            fprintf(out, ")");
+        }
+        if (option->env) {
+            fprintf(out, ",\n      .env = ");
+            gen_string(out, option->env);
+        }
+        fprintf(out, ",\n      .result = &%s_options[%s] },\n", p,
+                option->name);
+    }
+    fprintf(out, "};\n\n");
+
+    fprintf(out, "static uint64_t %s_storage[_CMDAPP_INDEX_WORDS(%s)];\n\n",
+            p, upper);
+    fprintf(out, "static const char %s_help[] =\n    ", p);
+    gen_string(out, help);
+    fprintf(out, ";\n\n");
+
+    fprintf(out, "static const cmdapp_table_t %s_table = {\n", p);
+    fprintf(out, "    .options = %s_descs,\n", p);
+    fprintf(out, "    .length = %s,\n", upper);
+    fprintf(out, "    .storage = %s_storage,\n", p);
+    fprintf(out, "    .storage_words = sizeof(%s_storage) / sizeof(uint64_t),"
+            "\n", p);
+    fprintf(out, "    .search_long = %s_search_long,\n", p);
+    fprintf(out, "    .masks = %s_masks,\n", p);
+    fprintf(out, "    .info = &%s_info,\n", p);
+    fprintf(out, "    .help = %s_help,\n", p);
+    fprintf(out, "    .help_length = sizeof(%s_help) - 1,\n", p);
+    fprintf(out, "    .help_width = %zu\n", help_width);
+    fprintf(out, "};\n");
+    if (fclose(out) != 0) {
+        perror(argv[2]);
+        return EXIT_FAILURE;
+    }
+
+    cmdapp_destroy(&app);
+    return EXIT_SUCCESS;
+}